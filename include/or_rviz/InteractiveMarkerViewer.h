@@ -32,7 +32,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef ORINTERACTIVEMARKER_H_
 #define ORINTERACTIVEMARKER_H_
 #include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/signals2.hpp>
+#include <boost/thread/mutex.hpp>
+#include <ros/time.h>
 // workaround for qt moc bug w.r.t. BOOST_JOIN macro
 // see https://bugreports.qt.io/browse/QTBUG-22829
 #ifndef Q_MOC_RUN
@@ -40,17 +43,61 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #endif
 #include <interactive_markers/interactive_marker_server.h>
 #include "markers/KinBodyMarker.h"
+#include "util/GraphBatcher.h"
 #include "util/InteractiveMarkerGraphHandle.h"
+#include "util/MarkerArrayPublisher.h"
+#include "util/PointDecimator.h"
 
 namespace or_rviz {
 
 class InteractiveMarkerViewer : public OpenRAVE::ViewerBase {
 public:
+    // Which bodies get an interactive marker, with a button and a menu, for
+    // each link. The rest are published as plain markers on the
+    // marker_array_topic_name_ topic, which is much cheaper for the server
+    // and for RViz.
+    enum InteractivePolicy {
+        InteractiveAll,
+        InteractiveRobots,
+        InteractiveNone
+    };
+
     InteractiveMarkerViewer(OpenRAVE::EnvironmentBasePtr env,
                             std::string const &topic_name);
+    virtual ~InteractiveMarkerViewer();
 
     void set_environment(OpenRAVE::EnvironmentBasePtr const &env);
     void set_parent_frame(std::string const &frame_id);
+    void set_dirty_tracking(bool enabled);
+    void set_pose_epsilon(double epsilon);
+
+    // Time in seconds that each sync may spend rebuilding geometry before
+    // deferring the remaining work to the next sync. Zero disables the limit.
+    void set_sync_budget(double budget);
+
+    // Meshes with more triangles than this are shown at a simplified level
+    // of detail, e.g. so remote RViz clients on slow links get a usable
+    // scene quickly. Zero shows every mesh in full.
+    void set_triangle_budget(size_t max_triangles);
+
+    // Pack small graphs (e.g. from plot3 or drawarrow) into shared markers.
+    // RViz slows down dramatically when there are many separate markers.
+    // Only unbatched graphs are returned as InteractiveMarkerGraphHandles
+    // that can be updated in place.
+    void set_graph_batching(bool enabled);
+
+    // Thin plot3 point clouds before publishing them, either by keeping one
+    // point per voxel or by keeping at most point_budget points. Zero
+    // disables either step.
+    void set_plot_decimation(double voxel_size, size_t point_budget);
+
+    // Bodies with pose controls, joint controls, ghost manipulators, or
+    // custom menu entries are always interactive.
+    void set_interactive_policy(InteractivePolicy policy);
+
+    // Overrides the policy for one body, by name.
+    void set_body_interactive(std::string const &body_name, bool interactive);
+    void clear_body_interactive(std::string const &body_name);
 
     virtual void SetEnvironmentSync(bool do_update);
     virtual void EnvironmentSync();
@@ -128,8 +175,11 @@ protected:
     bool running_;
     bool do_sync_;
     std::string topic_name_;
+    std::string marker_array_topic_name_;
     boost::signals2::signal<ViewerCallbackFn> viewer_callbacks_;
 
+    bool IsOverBudget(ros::WallTime const &sync_start) const;
+
 private:
     typedef bool SelectionCallbackFn(OpenRAVE::KinBody::LinkPtr plink,
                                      OpenRAVE::RaveVector<float>,
@@ -138,22 +188,71 @@ private:
     OpenRAVE::EnvironmentBasePtr env_;
     boost::shared_ptr<interactive_markers::InteractiveMarkerServer> server_;
     OpenRAVE::UserDataPtr body_callback_handle_;
+    // Graph handles may be created, updated, and destroyed from any thread.
+    boost::mutex graph_handles_mutex_;
     boost::unordered_set<util::InteractiveMarkerGraphHandle *> graph_handles_;
+    util::GraphBatcherPtr graph_batcher_;
+    bool graph_batching_;
+    util::PointDecimator plot_decimator_;
+    util::MarkerArrayPublisherPtr plain_publisher_;
+
+    // Bodies that changed since the last sync. Change callbacks may fire from
+    // any thread that modifies the environment, so this is locked separately.
+    bool dirty_tracking_;
+    size_t sync_count_;
+    boost::mutex dirty_mutex_;
+    boost::unordered_map<OpenRAVE::KinBody *, OpenRAVE::KinBodyWeakPtr> dirty_bodies_;
+
+    // Bodies whose geometry rebuild did not fit in the last sync's budget.
+    // These are only accessed from the viewer thread.
+    double sync_budget_;
+    std::vector<OpenRAVE::KinBodyWeakPtr> deferred_bodies_;
 
     boost::signals2::signal<SelectionCallbackFn> selection_callbacks_;
     std::stringstream menu_queue_;
 
     bool parent_frame_id_changed_;
     std::string parent_frame_id_;
+    double pose_epsilon_;
+    bool triangle_budget_changed_;
+    size_t triangle_budget_;
+
+    // Commands may change these from any thread.
+    boost::mutex interactive_mutex_;
+    bool interactive_changed_;
+    InteractivePolicy interactive_policy_;
+    boost::unordered_map<std::string, bool> interactive_overrides_;
 
     // Arbitrarily convert openrave point pixel size to meters for rendering
     float pixels_to_meters_;
 
     bool AddMenuEntryCommand(std::ostream &out, std::istream &in);
     bool GetMenuSelectionCommand(std::ostream &out, std::istream &in);
+    bool SetDirtyTrackingCommand(std::ostream &out, std::istream &in);
+    bool SetPoseEpsilonCommand(std::ostream &out, std::istream &in);
+    bool SetMeshCacheDirectoryCommand(std::ostream &out, std::istream &in);
+    bool SetSyncBudgetCommand(std::ostream &out, std::istream &in);
+    bool SetTriangleBudgetCommand(std::ostream &out, std::istream &in);
+    bool SetGraphBatchingCommand(std::ostream &out, std::istream &in);
+    bool SetPlotDecimationCommand(std::ostream &out, std::istream &in);
+    bool GetPlotDecimationStatsCommand(std::ostream &out, std::istream &in);
+    bool SetInteractivePolicyCommand(std::ostream &out, std::istream &in);
+    bool SetBodyInteractiveCommand(std::ostream &out, std::istream &in);
+
+    markers::KinBodyMarkerPtr FindBodyMarker(OpenRAVE::KinBodyPtr const &body) const;
+    markers::KinBodyMarkerPtr GetBodyMarker(OpenRAVE::KinBodyPtr const &body);
+    bool IsBodyInteractive(OpenRAVE::KinBodyPtr const &body);
+    void SyncBody(OpenRAVE::KinBodyPtr const &body,
+                  markers::KinBodyMarkerPtr const &body_marker);
+    void SyncBodies(std::vector<OpenRAVE::KinBodyPtr> const &bodies,
+                    ros::WallTime const &sync_start);
+    void SyncAllBodies(ros::WallTime const &sync_start);
+    void SyncDirtyBodies(ros::WallTime const &sync_start);
+    void DiscoverBodies();
 
     void GraphHandleRemovedCallback(util::InteractiveMarkerGraphHandle *handle);
     void BodyCallback(OpenRAVE::KinBodyPtr kinbody, int flag);
+    void BodyChangedCallback(OpenRAVE::KinBodyWeakPtr const &weak_body);
     void KinBodyMenuCallback(OpenRAVE::KinBodyPtr kinbody, std::string const &name);
     void LinkMenuCallback(OpenRAVE::KinBody::LinkPtr link, std::string const &name);
     void ManipulatorMenuCallback(OpenRAVE::RobotBase::ManipulatorPtr manipulator,
@@ -163,14 +262,13 @@ private:
     util::InteractiveMarkerGraphHandlePtr CreateGraphHandle(
         visualization_msgs::InteractiveMarkerPtr const &marker
     );
+    OpenRAVE::GraphHandlePtr CreateGraph(
+        visualization_msgs::InteractiveMarkerPtr const &marker
+    );
 
-    void ConvertPoints(float const *points, int num_points, int stride,
-                       std::vector<geometry_msgs::Point> *out_points) const;
-    void ConvertColors(float const *colors, int num_colors, bool has_alpha,
-                       std::vector<std_msgs::ColorRGBA> *out_colors) const;
-    void ConvertMesh(float const *points, int stride,
-                     int const *indices, int num_triangles,
-                     std::vector<geometry_msgs::Point> *out_points) const;
+    void DecimatePlot(visualization_msgs::Marker *marker);
+    void ConvertArrow(visualization_msgs::Marker const &arrow,
+                      std::vector<geometry_msgs::Point> *out_points) const;
 };
 
 }
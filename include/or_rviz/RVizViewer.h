@@ -35,7 +35,15 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QAction>
 #include <QMenu>
 #include <QTimer>
+#include <deque>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/weak_ptr.hpp>
 #include <rviz/default_plugin/interactive_marker_display.h>
+#include <rviz/default_plugin/marker_array_display.h>
 #include <rviz/visualization_frame.h>
 #include "rviz/EnvironmentDisplay.h"
 #include "InteractiveMarkerViewer.h"
@@ -44,20 +52,132 @@ namespace or_rviz {
 
 namespace detail {
 
+// One or more views of the same size, rendered in the same sync. View i is
+// written to memory + i * width * height * (depth / 8). If with_depth is set,
+// the metric depth of view i is also written to depth + i * width * height.
+//
+// The request owns its output buffer and is shared between the caller and
+// the render queue, so a caller that gives up on a request never leaves the
+// render thread writing into freed memory.
+// Lock and condition of the render queue. The condition is signalled
+// whenever the queue gets shorter, so submitters blocked on a full queue
+// check it again. Requests hold it weakly so that cancelling one after the
+// viewer is gone is harmless.
+struct OffscreenRenderQueue {
+    boost::mutex mutex;
+    boost::condition_variable condition;
+};
+
+typedef boost::shared_ptr<OffscreenRenderQueue> OffscreenRenderQueuePtr;
+
 struct OffscreenRenderRequest {
     OffscreenRenderRequest();
 
+    boost::weak_ptr<OffscreenRenderQueue> queue;
+
+    boost::mutex mutex;
+    boost::condition_variable condition;
     bool done;
+    bool cancelled;
+
+    int width;
+    int height;
+    int depth;
+    bool with_depth;
+    std::vector<uint8_t> memory;
+    std::vector<float> depth_memory;
+    std::vector<OpenRAVE::RaveTransform<float> > extrinsics;
+    std::vector<OpenRAVE::SensorBase::CameraIntrinsics> intrinsics;
+};
+
+typedef boost::shared_ptr<OffscreenRenderRequest> OffscreenRenderRequestPtr;
+
+class DepthMaterialListener;
+
+// A frame read back from the main render window for the viewer image
+// callbacks. The buffer is re-used across frames.
+struct ViewerImage {
+    ViewerImage();
+
     int width;
     int height;
     int depth;
-    uint8_t *memory;
-    OpenRAVE::RaveTransform<float> extrinsics;
-    OpenRAVE::SensorBase::CameraIntrinsics intrinsics;
+    std::vector<uint8_t> data;
+};
+
+// Render textures for offscreen rendering, re-used across requests of the
+// same size and pixel format. Creating a render texture allocates GPU
+// resources, which is too slow to do for every frame of a simulated camera.
+// Textures are only created and destroyed on the GUI thread, but the
+// statistics may be read from any thread.
+class RenderTargetPool {
+public:
+    explicit RenderTargetPool(size_t capacity);
+
+    size_t size() const;
+    size_t capacity() const;
+    size_t hits() const;
+    size_t misses() const;
+    size_t evictions() const;
+
+    // Returns a render texture with a viewport for camera. When the pool is
+    // full, this evicts the least recently used texture.
+    Ogre::RenderTexture *Acquire(int width, int height,
+                                 Ogre::PixelFormat pixel_format,
+                                 Ogre::Camera *camera);
+    void Clear();
+
+private:
+    struct Entry {
+        Ogre::RenderTexture *render_texture;
+        size_t last_used;
+    };
+
+    mutable boost::mutex mutex_;
+    size_t capacity_;
+    size_t tick_;
+    size_t hits_;
+    size_t misses_;
+    size_t evictions_;
+    boost::unordered_map<std::string, Entry> entries_;
+
+    // Requires mutex_ to be held.
+    void Remove(std::string const &name);
 };
 
 }
 
+// Handle to images that are being rendered offscreen. A default-constructed
+// future, or one returned when the render queue is full, is not valid.
+class OffscreenRenderFuture {
+public:
+    OffscreenRenderFuture();
+
+    bool valid() const;
+    bool is_ready() const;
+    bool is_cancelled() const;
+
+    // Blocks until the images are ready, the request is cancelled, or timeout
+    // seconds elapse. A negative timeout waits forever. Returns is_ready().
+    bool Wait(double timeout = -1.) const;
+
+    // Moves the images into memory. Returns false if they are not ready.
+    bool Get(std::vector<uint8_t> *memory);
+    bool Get(std::vector<uint8_t> *memory, std::vector<float> *depth);
+
+    // The request is dropped from the render queue on the next sync. Images
+    // that are already being rendered are discarded.
+    void Cancel();
+
+private:
+    friend class RVizViewer;
+
+    detail::OffscreenRenderRequestPtr request_;
+
+    explicit OffscreenRenderFuture(
+        detail::OffscreenRenderRequestPtr const &request);
+};
+
 class RVizViewer : public ::rviz::VisualizationFrame,
                    public InteractiveMarkerViewer {
     Q_OBJECT
@@ -67,6 +187,7 @@ public:
 
     RVizViewer(OpenRAVE::EnvironmentBasePtr env,
                std::string const &topic_name, bool anonymize);
+    virtual ~RVizViewer();
 
     int main(bool bShow);
     void quitmainloop();
@@ -82,9 +203,16 @@ public:
     virtual std::string const &GetName() const;
     virtual void SetName(std::string const &name);
     
+    // Callbacks run on a worker thread, not the GUI thread. The image is only
+    // valid for the duration of the callback.
     virtual OpenRAVE::UserDataPtr RegisterViewerImageCallback(
         OpenRAVE::ViewerBase::ViewerImageCallbackFn const &cb);
 
+    // Maximum rate, in Hz, at which frames are captured for the viewer image
+    // callbacks. Zero captures every repaint.
+    double viewer_image_rate() const;
+    void set_viewer_image_rate(double rate);
+
     virtual OpenRAVE::RaveTransform<float> GetCameraTransform() const;
     virtual OpenRAVE::geometry::RaveCameraIntrinsics<float> GetCameraIntrinsics() const;
     virtual void SetCamera(OpenRAVE::RaveTransform<float> &trans, float focalDistance = 0);
@@ -92,6 +220,38 @@ public:
                         OpenRAVE::RaveTransform<float> const &t,
                         OpenRAVE::SensorBase::CameraIntrinsics const &intrinsics);
 
+    // Renders all views in one sync. The images are packed back-to-back in
+    // memory, in the same order as extrinsics.
+    bool GetCameraImages(
+        std::vector<uint8_t> &memory, int width, int height,
+        std::vector<OpenRAVE::RaveTransform<float> > const &extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> const &intrinsics);
+
+    // Same as GetCameraImages, but returns without waiting for the render.
+    // If the render queue is full, this waits up to queue_timeout seconds for
+    // space (forever if negative) and returns an invalid future on failure.
+    OffscreenRenderFuture GetCameraImagesAsync(
+        int width, int height,
+        std::vector<OpenRAVE::RaveTransform<float> > const &extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> const &intrinsics,
+        double queue_timeout = 0.);
+
+    // Renders color and metric depth, along the optical axis, from the same
+    // camera poses in one sync. Depth is zero where nothing was rendered.
+    bool GetRGBDImages(
+        std::vector<uint8_t> &memory, std::vector<float> &depth,
+        int width, int height,
+        std::vector<OpenRAVE::RaveTransform<float> > const &extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> const &intrinsics);
+    OffscreenRenderFuture GetRGBDImagesAsync(
+        int width, int height,
+        std::vector<OpenRAVE::RaveTransform<float> > const &extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> const &intrinsics,
+        double queue_timeout = 0.);
+
+    size_t max_offscreen_queue_depth() const;
+    void set_max_offscreen_queue_depth(size_t depth);
+
 public Q_SLOTS:
     void LoadEnvironmentSlot();
     void EnvironmentSyncSlot();
@@ -101,20 +261,35 @@ private:
     ::rviz::RenderPanel *rviz_main_panel_;
     Ogre::SceneManager *rviz_scene_manager_;
     ::rviz::InteractiveMarkerDisplay *markers_display_;
+    ::rviz::MarkerArrayDisplay *marker_array_display_;
 
     rviz::EnvironmentDisplay *environment_display_;
     boost::signals2::connection environment_change_handle_;
     boost::signals2::connection environment_frame_handle_;
 
-    boost::mutex offscreen_mutex_;
-    boost::condition_variable offscreen_condition_;
-    std::list<detail::OffscreenRenderRequest *> offscreen_requests_;
+    detail::OffscreenRenderQueuePtr offscreen_queue_;
+    std::deque<detail::OffscreenRenderRequestPtr> offscreen_requests_;
+    size_t max_offscreen_queue_depth_;
 
     ::rviz::RenderPanel *offscreen_panel_;
     Ogre::RenderWindow *offscreen_main_panel_;
     Ogre::Camera *offscreen_camera_;
+    detail::RenderTargetPool offscreen_targets_;
+    boost::shared_ptr<detail::DepthMaterialListener> offscreen_depth_listener_;
     boost::signals2::signal<ViewerImageCallbackFn> viewer_image_callbacks_;
 
+    // The GUI thread reads back into viewer_images_[viewer_image_write_index_]
+    // while the worker thread dispatches callbacks from the other buffer.
+    mutable boost::mutex viewer_image_mutex_;
+    boost::condition_variable viewer_image_condition_;
+    detail::ViewerImage viewer_images_[2];
+    size_t viewer_image_write_index_;
+    bool viewer_image_pending_;
+    bool viewer_image_stopping_;
+    double viewer_image_rate_;
+    ros::WallTime viewer_image_last_capture_;
+    boost::thread viewer_image_thread_;
+
     QTimer *timer_;
     QMenu *menu_openrave_;
     QMenu *menu_environments_;
@@ -124,21 +299,45 @@ private:
     void InitializeMenus();
     void InitializeLighting();
     void InitializeOffscreenRendering();
+    void InitializeOffscreenDepth();
     ::rviz::InteractiveMarkerDisplay *InitializeInteractiveMarkers();
+    ::rviz::MarkerArrayDisplay *InitializeMarkerArray();
     rviz::EnvironmentDisplay *InitializeEnvironmentDisplay(
         OpenRAVE::EnvironmentBasePtr const &env);
 
     QAction *LoadEnvironmentAction();
     
-    void ProcessOffscreenRenderRequests();
-    unsigned char *WriteCurrentView(int *width, int *height, int *depth);
-
+    OffscreenRenderFuture SubmitOffscreenRenderRequest(
+        int width, int height,
+        std::vector<OpenRAVE::RaveTransform<float> > const &extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> const &intrinsics,
+        bool with_depth, double queue_timeout);
+    void ProcessOffscreenRenderRequests(ros::WallTime const &sync_start);
+    void PruneOffscreenRenderRequests();
+    void CaptureViewerImage();
+    void WriteCurrentView(detail::ViewerImage *image);
+    void ViewerImageThread();
+
+    bool GetCameraImagesCommand(std::ostream &out, std::istream &in);
+    bool GetRGBDImagesCommand(std::ostream &out, std::istream &in);
+    bool GetOffscreenStatsCommand(std::ostream &out, std::istream &in);
+    bool SetOffscreenQueueDepthCommand(std::ostream &out, std::istream &in);
+    bool SetViewerImageRateCommand(std::ostream &out, std::istream &in);
+
+    void ParseCameraViews(
+        std::istream &in, int num_views, std::string const &command,
+        std::vector<OpenRAVE::RaveTransform<float> > *extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> *intrinsics) const;
     Ogre::PixelFormat GetPixelFormat(int depth) const;
     std::string GenerateTopicName(std::string const &base_name, bool anonymize) const;
     virtual void SetCamera(
         Ogre::Camera *camera,
         OpenRAVE::RaveTransform<float> const &trans,
         float focalDistance) const;
+    void SetCameraIntrinsics(
+        Ogre::Camera *camera,
+        OpenRAVE::SensorBase::CameraIntrinsics const &intrinsics,
+        int width, int height) const;
 
 };
 
@@ -59,7 +59,8 @@ public:
     void set_pose(OpenRAVE::Transform const &pose);
 
     double angle() const;
-    
+    bool is_active() const;
+
     void set_joint_pose(OpenRAVE::Transform const &pose);
 
     virtual bool EnvironmentSync();
@@ -51,7 +51,15 @@ public:
                        OpenRAVE::KinBody::JointPtr joint);
     virtual ~KinBodyJointMarker();
 
+    // Value of the joint requested by the handle. Returns false unless the
+    // handle is being dragged and has moved since the last value it returned,
+    // so values set by other code between syncs are left alone.
+    bool GetPendingValue(OpenRAVE::dReal *value);
+
     virtual bool EnvironmentSync();
+
+private:
+    OpenRAVE::dReal last_value_;
 };
 
 }
@@ -46,6 +46,7 @@ public:
                       OpenRAVE::KinBody::LinkPtr link);
 
     interactive_markers::MenuHandler &menu_handler();
+    void set_changed_callback(boost::function<void ()> const &callback);
 
     virtual bool EnvironmentSync();
     void UpdateMenu();
@@ -54,6 +55,7 @@ private:
     typedef interactive_markers::MenuHandler MenuHandler;
 
     bool menu_changed_;
+    boost::function<void ()> changed_callback_;
     std::vector<visualization_msgs::MenuEntry> menu_entries_;
     MenuHandler menu_handler_;
     MenuHandler::EntryHandle menu_link_;
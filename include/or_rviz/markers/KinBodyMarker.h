@@ -94,6 +94,23 @@ public:
     std::string id() const;
 
     void set_parent_frame(std::string const &frame_id);
+    void set_pose_epsilon(double epsilon);
+    void set_triangle_budget(size_t max_triangles);
+    void set_dirty_callback(boost::function<void ()> const &callback);
+
+    // Publish the links as plain markers, without buttons or menus. Bodies
+    // with pose controls, joint controls, ghost manipulators, or custom menu
+    // entries stay interactive, as do bodies that are moving. NULL makes every
+    // link interactive.
+    void set_plain_publisher(util::MarkerArrayPublisherPtr const &publisher);
+
+    // True if this body has controls or pending mesh loads that must be
+    // polled on every sync, even when nothing in the environment changed.
+    bool is_active() const;
+
+    // True if the next EnvironmentSync has to build or rebuild any link
+    // geometry, as opposed to only updating poses.
+    bool has_geometry_changes() const;
 
     void AddMenuEntry(std::string const &name, boost::function<void ()> const &callback);
     void AddMenuEntry(OpenRAVE::KinBody::LinkPtr link,
@@ -102,6 +119,7 @@ public:
                       std::string const &name, boost::function<void ()> const &callback);
 
     void EnvironmentSync();
+    void Invalidate();
 
     std::vector<std::string> group_names() const;
     void SwitchGeometryGroup(std::string const &group);
@@ -112,11 +130,23 @@ private:
     OpenRAVE::RobotBaseWeakPtr robot_;
     OpenRAVE::UserDataPtr handle_kinbody_;
     OpenRAVE::UserDataPtr handle_links_;
+    OpenRAVE::UserDataPtr handle_geometry_;
     OpenRAVE::UserDataPtr handle_manipulators_;
+    OpenRAVE::UserDataPtr handle_manipulator_solvers_;
+    OpenRAVE::UserDataPtr handle_transforms_;
+    boost::function<void ()> dirty_callback_;
     std::string parent_frame_id_;
+    double pose_epsilon_;
+    size_t triangle_budget_;
+    util::MarkerArrayPublisherPtr plain_publisher_;
     bool has_pose_controls_;
     bool has_joint_controls_;
 
+    // State of the body when it last moved, e.g. because it is grabbed.
+    OpenRAVE::Transform last_transform_;
+    std::vector<OpenRAVE::dReal> last_dof_values_;
+    ros::WallTime last_moved_;
+
     visualization_msgs::InteractiveMarkerPtr interactive_marker_;
 
     std::vector<CustomMenuEntry> menu_custom_kinbody_;
@@ -127,10 +157,16 @@ private:
     boost::unordered_map<OpenRAVE::KinBody::Joint *, KinBodyJointMarkerPtr> joint_markers_;
     boost::unordered_map<OpenRAVE::RobotBase::Manipulator *, ManipulatorMarkerPtr> manipulator_markers_;
 
+    void ApplyJointControls(OpenRAVE::KinBodyPtr const &kinbody);
     void InvalidateKinBody();
     void InvalidateLinks();
+    void InvalidateGeometry();
     void InvalidateManipulators();
+    void InvalidateManipulatorSolvers();
 
+    bool IsInteractive() const;
+    bool IsMoving() const;
+    void UpdateMotion(OpenRAVE::KinBodyPtr const &kinbody);
     bool HasGhostManipulator(OpenRAVE::RobotBase::ManipulatorPtr const manipulator) const;
 
     void CreateMenu(LinkMarkerWrapper &link_wrapper);
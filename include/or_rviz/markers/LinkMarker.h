@@ -43,6 +43,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <visualization_msgs/InteractiveMarker.h>
 #include <interactive_markers/menu_handler.h>
 #include <interactive_markers/interactive_marker_server.h>
+#include "util/MarkerArrayPublisher.h"
+#include "util/TriMeshCache.h"
 
 namespace or_rviz {
 namespace markers {
@@ -53,6 +55,7 @@ typedef boost::shared_ptr<LinkMarker> LinkMarkerPtr;
 class LinkMarker {
 public:
     static OpenRAVE::Vector const kCollisionColor;
+    static double const kDefaultPoseEpsilon;
 
     LinkMarker(boost::shared_ptr<interactive_markers::InteractiveMarkerServer> server,
                OpenRAVE::KinBody::LinkPtr link, bool is_ghost);
@@ -63,7 +66,12 @@ public:
     interactive_markers::MenuHandler &menu_handler();
     visualization_msgs::InteractiveMarkerPtr interactive_marker();
 
-    void set_pose(OpenRAVE::Transform const &pose) const;
+    void set_pose(OpenRAVE::Transform const &pose);
+    void set_pose_epsilon(double epsilon);
+
+    // Meshes with more triangles than this are replaced by a simplified
+    // level of detail. Zero always shows the full mesh.
+    void set_triangle_budget(size_t max_triangles);
 
     void clear_color();
     void set_color(OpenRAVE::Vector const &color);
@@ -76,6 +84,21 @@ public:
 
     void set_parent_frame(std::string const &frame_id);
 
+    // Publish the link as plain markers instead of as an interactive marker.
+    // The link then has no button or menu, but costs the server and RViz much
+    // less. Every pose change re-sends the link's markers, so this is meant
+    // for links that rarely move. NULL switches back to the interactive
+    // marker server.
+    void set_plain_publisher(util::MarkerArrayPublisherPtr const &publisher);
+    bool is_interactive() const;
+
+    // True if a placeholder is displayed while a mesh loads or is simplified
+    // in the background.
+    bool is_loading() const;
+
+    // True if the next EnvironmentSync will re-create or re-color the marker.
+    bool has_geometry_changes() const;
+
     std::vector<std::string> group_names() const;
     void SwitchGeometryGroup(std::string const &group);
 
@@ -85,35 +108,57 @@ public:
 
 protected:
     boost::shared_ptr<interactive_markers::InteractiveMarkerServer> server_;
+    util::MarkerArrayPublisherPtr plain_publisher_;
     visualization_msgs::InteractiveMarkerPtr interactive_marker_;
     visualization_msgs::InteractiveMarkerControl *visual_control_;
 
 private:
+    // Geometry that each entry in visual_control_->markers was created from.
+    // This is used to re-color the markers without re-creating them.
+    struct MarkerSource {
+        boost::weak_ptr<OpenRAVE::KinBody::Link::Geometry> geometry;
+        bool is_collision;
+    };
+
     OpenRAVE::KinBody::LinkWeakPtr link_;
     OpenRAVE::RobotBase::ManipulatorPtr manipulator_;
     bool is_ghost_;
     bool created_;
     bool force_update_;
+    bool color_changed_;
     bool view_visual_;
     bool view_collision_;
+    double pose_epsilon_;
+    size_t triangle_budget_;
 
     boost::optional<OpenRAVE::Vector> override_color_;
+    boost::optional<OpenRAVE::Transform> published_pose_;
 
     boost::unordered_map<
         OpenRAVE::KinBody::Link::Geometry *, bool> visibility_map_;
-    boost::unordered_map<
-        OpenRAVE::KinBody::Link::Geometry *,
-        std::vector<visualization_msgs::Marker *> > geometry_markers_;
+    std::vector<MarkerSource> marker_sources_;
+    std::vector<std::pair<std::string, OpenRAVE::Vector> > pending_meshes_;
+    std::vector<boost::weak_ptr<OpenRAVE::KinBody::Link::Geometry> > pending_collision_meshes_;
 
     void CreateGeometry();
+    void UpdateColors();
+    void AddMarker(OpenRAVE::KinBody::Link::GeometryPtr const &geometry,
+                   bool is_collision, visualization_msgs::MarkerPtr const &marker);
+    void SetMarkerColor(OpenRAVE::KinBody::Link::GeometryPtr const &geometry,
+                        bool is_collision, visualization_msgs::Marker *marker) const;
     visualization_msgs::MarkerPtr CreateVisualGeometry(
             OpenRAVE::KinBody::Link::GeometryPtr geometry);
     visualization_msgs::MarkerPtr CreateCollisionGeometry(
             OpenRAVE::KinBody::Link::GeometryPtr geometry);
+    visualization_msgs::MarkerPtr CreatePlaceholderGeometry(
+            OpenRAVE::KinBody::Link::GeometryPtr geometry);
+    bool IsLoadFinished() const;
+    void PublishPlainMarkers(OpenRAVE::Transform const &pose);
 
+    bool IsPoseChanged(OpenRAVE::Transform const &pose) const;
     bool HasTexture(std::string const &uri) const;
     bool HasRVizSupport(std::string const &uri) const;
-    void TriMeshToMarker(OpenRAVE::TriMesh const &trimesh,
+    void TriMeshToMarker(util::TriMeshCache::PointListConstPtr const &points,
                          visualization_msgs::MarkerPtr const &marker);
 };
 
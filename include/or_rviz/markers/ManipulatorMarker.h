@@ -40,6 +40,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <interactive_markers/interactive_marker_server.h>
 #include "LinkMarker.h"
 #include "JointMarker.h"
+#include "util/AsyncIkSolver.h"
 
 namespace or_rviz {
 namespace markers {
@@ -51,6 +52,7 @@ class ManipulatorMarker {
 public:
     static OpenRAVE::Vector const kValidColor;
     static OpenRAVE::Vector const kInvalidColor;
+    static OpenRAVE::Vector const kStaleColor;
 
     ManipulatorMarker(boost::shared_ptr<interactive_markers::InteractiveMarkerServer> server,
                       OpenRAVE::RobotBase::ManipulatorPtr manipulator);
@@ -60,10 +62,16 @@ public:
     bool is_hidden() const;
 
     void set_parent_frame(std::string const &frame_id);
+    void set_pose_epsilon(double epsilon);
+    void set_triangle_budget(size_t max_triangles);
 
     bool EnvironmentSync();
     void UpdateMenu();
 
+    // Forget everything derived from the IK solver, e.g. the free joints,
+    // because the solver changed. It is re-built on the next EnvironmentSync.
+    void InvalidateIkSolver();
+
 private:
     boost::shared_ptr<interactive_markers::InteractiveMarkerServer> server_;
     OpenRAVE::RobotBase::ManipulatorPtr manipulator_;
@@ -78,11 +86,28 @@ private:
     bool has_ik_;
     bool force_update_;
     bool hidden_;
+    bool has_free_joints_;
+    size_t triangle_budget_;
 
     OpenRAVE::Transform current_pose_;
     std::vector<OpenRAVE::dReal> current_ik_;
     std::vector<OpenRAVE::dReal> current_free_;
 
+    // Inferring the free joints requires 2N forward kinematics evaluations,
+    // so we only do it when the IK solver changes.
+    std::vector<OpenRAVE::KinBody::JointPtr> free_joints_;
+    std::vector<int> free_dof_indices_;
+
+    // Private copy of the robot used to compute the pose of the ghost. We
+    // remember the state it was last posed in to skip FK when nothing moved.
+    util::RobotClonePtr ghost_;
+    std::vector<OpenRAVE::dReal> ghost_values_;
+    OpenRAVE::Transform ghost_transform_;
+
+    // Solves IK on a clone of the robot, so slow solvers don't block the
+    // viewer. The ghost shows the last valid solution in the meantime.
+    util::AsyncIkSolverPtr async_ik_;
+
     interactive_markers::MenuHandler menu_handler_;
     interactive_markers::MenuHandler::EntryHandle menu_set_;
     interactive_markers::MenuHandler::EntryHandle menu_reset_;
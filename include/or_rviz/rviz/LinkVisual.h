@@ -55,6 +55,9 @@ namespace or_rviz
                 VisualMesh
             };
 
+            // Vertices closer than this are merged when converting meshes.
+            static const float kDefaultWeldEpsilon;
+
             LinkVisual(KinBodyVisual* kinBody, OpenRAVE::KinBody::LinkPtr link, Ogre::SceneNode* parent, Ogre::SceneManager* sceneManager);
             virtual ~LinkVisual();
 
@@ -68,6 +71,10 @@ namespace or_rviz
 
             inline KinBodyVisual* GetKinBody() { return m_kinBody; }
             inline void SetKinBody(KinBodyVisual* value) { m_kinBody = value; }
+            // Set to zero to disable welding.
+            inline float GetWeldEpsilon() { return m_weldEpsilon; }
+            inline void SetWeldEpsilon(float value) { m_weldEpsilon = value; }
+
             Ogre::MeshPtr meshToOgre(const OpenRAVE::TriMesh& trimesh, std::string name);
             std::string getMeshName(std::string const filename) const;
 
@@ -94,6 +101,7 @@ namespace or_rviz
             Ogre::SceneNode* m_parentNode;
             Ogre::SceneManager* m_sceneManager;
             RenderMode m_renderMode;
+            float m_weldEpsilon;
 
     };
 
@@ -0,0 +1,92 @@
+#ifndef ASYNCIKSOLVER_H_
+#define ASYNCIKSOLVER_H_
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/thread_time.hpp>
+// workaround for qt moc bug w.r.t. BOOST_JOIN macro
+// see https://bugreports.qt.io/browse/QTBUG-22829
+#ifndef Q_MOC_RUN
+    #include <openrave/openrave.h>
+#endif
+#include "util/RobotClone.h"
+
+namespace or_rviz {
+namespace util {
+
+class AsyncIkSolver;
+typedef boost::shared_ptr<AsyncIkSolver> AsyncIkSolverPtr;
+
+// Solves IK for one manipulator on a worker thread.
+//
+// Requests are coalesced: submitting a new target replaces any request that
+// has not started yet. Every finished request is published, even if a newer
+// one arrived while it was being solved, so a slow solver still updates the
+// result while the target moves. The solver runs on a clone of the robot, so
+// it never touches (or locks) the live environment.
+class AsyncIkSolver : public boost::noncopyable {
+public:
+    struct Result {
+        bool has_solution;
+        std::vector<OpenRAVE::dReal> solution;
+    };
+
+    // The caller must hold the manipulator's environment lock.
+    explicit AsyncIkSolver(OpenRAVE::RobotBase::ManipulatorPtr const &manipulator);
+    ~AsyncIkSolver();
+
+    // True if the latest request has not been solved yet, i.e. the last
+    // result is stale.
+    bool is_pending() const;
+
+    // How long the result has been stale: the time since the last result was
+    // published, or since the solver went idle, while a request is pending.
+    // Zero if nothing is pending.
+    boost::posix_time::time_duration pending_duration() const;
+
+    // Request an IK solution for pose, starting from the given state of the
+    // robot (e.g. to set the free joints).
+    void Submit(OpenRAVE::Transform const &pose,
+                std::vector<OpenRAVE::dReal> const &dof_values,
+                OpenRAVE::Transform const &robot_transform);
+
+    // Drop any request that has not been solved yet.
+    void Cancel();
+
+    // Returns true and fills result if a request finished since the last
+    // call to GetResult.
+    bool GetResult(Result *result);
+
+private:
+    struct Request {
+        size_t id;
+        OpenRAVE::Transform pose;
+        std::vector<OpenRAVE::dReal> dof_values;
+        OpenRAVE::Transform robot_transform;
+    };
+
+    RobotClonePtr clone_;
+    OpenRAVE::RobotBase::ManipulatorPtr manipulator_;
+
+    mutable boost::mutex mutex_;
+    boost::condition_variable condition_;
+    bool stopping_;
+    size_t latest_id_;
+    size_t solved_id_;
+    size_t cancelled_id_;
+    boost::system_time stale_since_;
+    boost::optional<Request> request_;
+    boost::optional<Result> result_;
+    boost::thread thread_;
+
+    void WorkerThread();
+};
+
+}
+}
+
+#endif
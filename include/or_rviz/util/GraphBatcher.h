@@ -0,0 +1,113 @@
+#ifndef GRAPHBATCHER_H_
+#define GRAPHBATCHER_H_
+#include <map>
+#include <vector>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <geometry_msgs/Point.h>
+#include <geometry_msgs/Vector3.h>
+#include <std_msgs/ColorRGBA.h>
+// workaround for qt moc bug w.r.t. BOOST_JOIN macro
+// see https://bugreports.qt.io/browse/QTBUG-22829
+#ifndef Q_MOC_RUN
+    #include <openrave/openrave.h>
+#endif
+#include <interactive_markers/interactive_marker_server.h>
+
+namespace or_rviz {
+namespace util {
+
+// Packs many small graphs into a few shared list markers.
+//
+// Each graph is a slice of a batch marker with the same type and scale. Its
+// GraphHandle shows, hides, moves, and removes only that slice. Batches are
+// rebuilt by Flush, so any number of changes between two syncs cost at most
+// one marker update per batch.
+//
+// Moving a slice transforms its points. CUBE_LIST and SPHERE_LIST draw every
+// point with the same axis-aligned shape, so rotating a slice of boxes moves
+// the boxes without rotating them.
+class GraphBatcher : public boost::enable_shared_from_this<GraphBatcher> {
+public:
+    typedef boost::shared_ptr<interactive_markers::InteractiveMarkerServer> InteractiveMarkerServerPtr;
+
+    static size_t const kMaxBatchPoints;
+
+    explicit GraphBatcher(InteractiveMarkerServerPtr const &server);
+    ~GraphBatcher();
+
+    void set_parent_frame(std::string const &frame_id);
+
+    // Returns true if Add supports this marker type and number of points.
+    // LINE_LIST and TRIANGLE_LIST slices must contain whole lines and
+    // triangles.
+    static bool IsBatchable(uint8_t type, size_t num_points);
+
+    // Adds a slice with one color per point. The handle removes the slice
+    // when it is destroyed.
+    OpenRAVE::GraphHandlePtr Add(uint8_t type,
+                                 geometry_msgs::Vector3 const &scale,
+                                 std::vector<geometry_msgs::Point> points,
+                                 std::vector<std_msgs::ColorRGBA> colors);
+
+    // Publishes every batch that changed since the last flush.
+    void Flush();
+
+private:
+    class Handle;
+
+    struct BatchKey {
+        BatchKey(uint8_t type, geometry_msgs::Vector3 const &scale);
+
+        bool operator<(BatchKey const &other) const;
+
+        uint8_t type;
+        double scale[3];
+    };
+
+    struct Batch {
+        explicit Batch(BatchKey const &key);
+
+        BatchKey key;
+        std::string name;
+        size_t num_points;
+        bool is_dirty;
+        bool is_published;
+        boost::unordered_set<size_t> slice_ids;
+    };
+
+    typedef boost::shared_ptr<Batch> BatchPtr;
+
+    struct Slice {
+        BatchPtr batch;
+        std::vector<geometry_msgs::Point> points;
+        std::vector<std_msgs::ColorRGBA> colors;
+        OpenRAVE::RaveTransform<float> transform;
+        bool show;
+    };
+
+    InteractiveMarkerServerPtr server_;
+
+    boost::mutex mutex_;
+    std::string frame_id_;
+    size_t next_slice_id_;
+    boost::unordered_map<size_t, Slice> slices_;
+    std::map<BatchKey, std::vector<BatchPtr> > batches_;
+
+    void Remove(size_t slice_id);
+    void SetShow(size_t slice_id, bool show);
+    void SetTransform(size_t slice_id, OpenRAVE::RaveTransform<float> const &t);
+
+    BatchPtr FindBatch(BatchKey const &key, size_t num_points);
+    void PublishBatch(Batch *batch);
+};
+
+typedef boost::shared_ptr<GraphBatcher> GraphBatcherPtr;
+
+}
+}
+
+#endif
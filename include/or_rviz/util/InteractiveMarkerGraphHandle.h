@@ -1,6 +1,8 @@
 #ifndef INTERACTIVEMARKERGRAPHHANDLE_H_
 #define INTERACTIVEMARKERGRAPHHANDLE_H_
+#include <vector>
 #include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
 // workaround for qt moc bug w.r.t. BOOST_JOIN macro
 // see https://bugreports.qt.io/browse/QTBUG-22829
 #ifndef Q_MOC_RUN
@@ -28,11 +30,29 @@ public:
     virtual void SetTransform(OpenRAVE::RaveTransform<float> const &t);
     virtual void SetShow(bool show);
 
+    // Replace the contents of the graph in place, e.g. to stream a point
+    // cloud. The marker keeps its name, so RViz re-uses its render objects.
+    // Updates are only published by Flush, so several updates between two
+    // syncs cost one publish. Colors must either be empty or match the
+    // number of points when the update is published.
+    void UpdatePoints(std::vector<geometry_msgs::Point> points);
+    void UpdatePoints(float const *points, int num_points, int stride);
+    void UpdateColors(std::vector<std_msgs::ColorRGBA> colors);
+    void UpdateColors(float const *colors, int num_colors, bool has_alpha);
+    void UpdateColor(OpenRAVE::RaveVector<float> const &color);
+
+    // Publishes pending changes. The viewer calls this once per sync.
+    void Flush();
+
 private:
     InteractiveMarkerServerPtr server_;
+    boost::mutex mutex_;
     visualization_msgs::InteractiveMarkerPtr interactive_marker_;
     boost::function<void (InteractiveMarkerGraphHandle *)> remove_callback_;
     bool show_;
+    bool is_dirty_;
+
+    visualization_msgs::Marker &marker();
 };
 
 typedef boost::shared_ptr<InteractiveMarkerGraphHandle> InteractiveMarkerGraphHandlePtr;
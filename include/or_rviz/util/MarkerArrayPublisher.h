@@ -0,0 +1,54 @@
+#ifndef MARKERARRAYPUBLISHER_H_
+#define MARKERARRAYPUBLISHER_H_
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
+#include <ros/ros.h>
+#include <visualization_msgs/MarkerArray.h>
+
+namespace or_rviz {
+namespace util {
+
+// Publishes groups of plain markers on a visualization_msgs/MarkerArray topic.
+//
+// This is the cheap alternative to InteractiveMarkerServer for objects that
+// nobody interacts with: there are no controls, menus, or keep-alives, and
+// RViz draws the markers without creating an interactive marker for each.
+// Each group is published in its own namespace with ids 0 to n - 1. Like the
+// server, changes are only published by Flush. New subscribers receive every
+// group when they connect.
+class MarkerArrayPublisher {
+public:
+    explicit MarkerArrayPublisher(std::string const &topic_name);
+    ~MarkerArrayPublisher();
+
+    // Adds or replaces every marker in a group. This overwrites the ns, id,
+    // and action of each marker.
+    void Insert(std::string const &name,
+                std::vector<visualization_msgs::Marker> markers);
+    void Erase(std::string const &name);
+
+    // Publishes the groups that changed since the last flush.
+    void Flush();
+
+private:
+    ros::NodeHandle node_handle_;
+    ros::Publisher publisher_;
+
+    boost::mutex mutex_;
+    boost::unordered_map<std::string, std::vector<visualization_msgs::Marker> > groups_;
+    boost::unordered_map<std::string, size_t> num_published_;
+    boost::unordered_set<std::string> dirty_names_;
+
+    void ConnectCallback(ros::SingleSubscriberPublisher const &publisher);
+};
+
+typedef boost::shared_ptr<MarkerArrayPublisher> MarkerArrayPublisherPtr;
+
+}
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef MESHDISKCACHE_H_
+#define MESHDISKCACHE_H_
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <geometry_msgs/Point.h>
+// workaround for qt moc bug w.r.t. BOOST_JOIN macro
+// see https://bugreports.qt.io/browse/QTBUG-22829
+#ifndef Q_MOC_RUN
+    #include <openrave/openrave.h>
+#endif
+
+namespace or_rviz {
+namespace util {
+
+// Optional on-disk cache of meshes loaded by OpenRAVE.
+//
+// Entries are keyed by the absolute path to the source file, its
+// modification time, and the scale it was loaded at. Each entry is one file
+// of flat arrays, so it can be memory-mapped and copied out without any
+// parsing. There are two kinds of entries:
+//
+// - Points hold the TRIANGLE_LIST points that markers display, followed by
+//   their LOD tiers. Loading these skips both converting and simplifying the
+//   mesh, so they are what TriMeshCache uses.
+// - Meshes hold the indexed TriMesh, for code that needs the original
+//   vertices and indices.
+//
+// The cache is disabled until a directory is set, either by calling
+// set_directory or through the OR_RVIZ_MESH_CACHE environment variable.
+class MeshDiskCache {
+public:
+    typedef std::vector<geometry_msgs::Point> PointList;
+    typedef boost::shared_ptr<PointList const> PointListConstPtr;
+
+    static char const * const kEnvironmentVariable;
+
+    static MeshDiskCache &instance();
+
+    std::string directory() const;
+    void set_directory(std::string const &directory);
+    bool is_enabled() const;
+
+    // Returns false if the mesh is not in the cache or is out of date.
+    bool Load(std::string const &path, OpenRAVE::Vector const &scale,
+              OpenRAVE::TriMesh *trimesh) const;
+    void Store(std::string const &path, OpenRAVE::Vector const &scale,
+               OpenRAVE::TriMesh const &trimesh) const;
+
+    // Points of a mesh and its LOD tiers, from most to least detailed.
+    // has_lods records whether the tiers were built, since small meshes have
+    // none. Returns false if the points are not in the cache or are out of
+    // date.
+    bool LoadPoints(std::string const &path, OpenRAVE::Vector const &scale,
+                    PointListConstPtr *points,
+                    std::vector<PointListConstPtr> *lods,
+                    bool *has_lods) const;
+    void StorePoints(std::string const &path, OpenRAVE::Vector const &scale,
+                     PointList const &points,
+                     std::vector<PointListConstPtr> const &lods,
+                     bool has_lods) const;
+
+private:
+    mutable boost::mutex mutex_;
+    std::string directory_;
+
+    MeshDiskCache();
+
+    bool GetEntry(std::string const &path, OpenRAVE::Vector const &scale,
+                  char const *extension,
+                  std::string *key, std::string *entry_path) const;
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef MESHSIMPLIFIER_H_
+#define MESHSIMPLIFIER_H_
+#include <vector>
+#include <geometry_msgs/Point.h>
+
+namespace or_rviz {
+namespace util {
+
+// Simplifies a triangle mesh by quadric edge collapse (Garland and Heckbert,
+// "Surface Simplification Using Quadric Error Metrics", 1997).
+//
+// The input is a TRIANGLE_LIST, i.e. three points per triangle. Coincident
+// points are merged first, so meshes that do not share vertices between
+// triangles (e.g. from STL files) still collapse across their edges.
+// Boundary edges are only collapsed along the boundary, which keeps open
+// meshes from shrinking. Collapses that would move the surface by more than
+// a small fraction of the mesh's size are refused, so sliver-heavy meshes may
+// stop short of the target instead of growing spikes.
+class MeshSimplifier {
+public:
+    typedef std::vector<geometry_msgs::Point> PointList;
+
+    explicit MeshSimplifier(PointList const &triangles);
+
+    size_t num_triangles() const;
+
+    // Collapses the cheapest edges until at most target_triangles remain, or
+    // until every remaining collapse would flip a triangle. This may be called
+    // again with a smaller target to continue from the current mesh.
+    void Simplify(size_t target_triangles);
+
+    void GetTriangles(PointList *points) const;
+
+private:
+    // Upper triangle of a symmetric 4x4 matrix.
+    struct Quadric {
+        Quadric();
+        Quadric(double a, double b, double c, double d);
+
+        Quadric &operator+=(Quadric const &other);
+        double Error(double const p[3]) const;
+        double Det(int a11, int a12, int a13, int a21, int a22, int a23,
+                   int a31, int a32, int a33) const;
+
+        double m[10];
+        double num_planes;
+    };
+
+    struct Vertex {
+        double p[3];
+        Quadric q;
+        size_t tstart;
+        size_t tcount;
+        bool border;
+    };
+
+    struct Triangle {
+        size_t v[3];
+        double error[4];
+        double normal[3];
+        bool deleted;
+        bool dirty;
+    };
+
+    // Triangle that uses a vertex, and which corner of it the vertex is.
+    struct Ref {
+        size_t tid;
+        size_t tvertex;
+    };
+
+    std::vector<Vertex> vertices_;
+    std::vector<Triangle> triangles_;
+    std::vector<Ref> refs_;
+    size_t num_deleted_;
+    double max_error_;
+
+    void Compact();
+    void UpdateRefs();
+    void InitializeQuadrics();
+    void UpdateNormal(Triangle *triangle) const;
+    double EdgeError(size_t iv0, size_t iv1, double p[3]) const;
+    bool IsFlipped(double const p[3], size_t iv1, Vertex const &v0,
+                   std::vector<bool> *deleted) const;
+    void UpdateTriangles(size_t iv0, Vertex const &v,
+                         std::vector<bool> const &deleted);
+};
+
+}
+}
+
+#endif
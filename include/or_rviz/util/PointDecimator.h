@@ -0,0 +1,56 @@
+#ifndef POINTDECIMATOR_H_
+#define POINTDECIMATOR_H_
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include <geometry_msgs/Point.h>
+#include <std_msgs/ColorRGBA.h>
+
+namespace or_rviz {
+namespace util {
+
+// Thins large point clouds before they are published.
+//
+// Voxel-grid decimation keeps the first point that falls in each voxel and
+// drops points with non-finite coordinates, e.g. invalid depth readings.
+// The point budget then keeps an evenly spaced subset of whatever is left.
+// Either step can be disabled by setting it to zero. Kept points retain
+// their color and their order in the input.
+//
+// Large clouds are split into chunks that are decimated in parallel.
+class PointDecimator {
+public:
+    PointDecimator();
+
+    double voxel_size() const;
+    void set_voxel_size(double voxel_size);
+
+    size_t point_budget() const;
+    void set_point_budget(size_t point_budget);
+
+    // Totals over every call to Decimate.
+    size_t num_input_points() const;
+    size_t num_dropped_points() const;
+
+    // Decimates points in place. Colors are either empty or one per point.
+    // Returns the number of points that were dropped.
+    size_t Decimate(std::vector<geometry_msgs::Point> *points,
+                    std::vector<std_msgs::ColorRGBA> *colors);
+
+private:
+    static size_t const kMinChunkPoints;
+
+    mutable boost::mutex mutex_;
+    double voxel_size_;
+    size_t point_budget_;
+    size_t num_input_points_;
+    size_t num_dropped_points_;
+
+    static void VoxelGridFilter(std::vector<geometry_msgs::Point> const &points,
+                                double voxel_size,
+                                std::vector<size_t> *indices);
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef ROBOTCLONE_H_
+#define ROBOTCLONE_H_
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+// workaround for qt moc bug w.r.t. BOOST_JOIN macro
+// see https://bugreports.qt.io/browse/QTBUG-22829
+#ifndef Q_MOC_RUN
+    #include <openrave/openrave.h>
+#endif
+
+namespace or_rviz {
+namespace util {
+
+class RobotClone;
+typedef boost::shared_ptr<RobotClone> RobotClonePtr;
+
+// Copy of a robot in its own, private environment.
+//
+// This is a full copy: a new environment plus a Clone_Bodies copy of all of
+// the robot's geometry, so it is expensive to construct and should be kept
+// for as long as the robot's kinematics don't change.
+//
+// The viewer uses clones for work that would otherwise have to modify the
+// live robot, e.g. solving IK or computing forward kinematics for a ghost
+// manipulator. The caller must hold the original robot's environment lock
+// while constructing the clone; afterwards the clone is independent of it.
+class RobotClone : public boost::noncopyable {
+public:
+    explicit RobotClone(OpenRAVE::RobotBasePtr const &robot);
+    ~RobotClone();
+
+    OpenRAVE::EnvironmentBasePtr env() const;
+    OpenRAVE::RobotBasePtr robot() const;
+
+    // Copies the DOF values and transform of the original robot.
+    static void GetState(OpenRAVE::RobotBasePtr const &robot,
+                         std::vector<OpenRAVE::dReal> *dof_values,
+                         OpenRAVE::Transform *transform);
+
+    // Puts the clone into a state captured with GetState. The caller must
+    // hold the clone's environment lock.
+    void SetState(std::vector<OpenRAVE::dReal> const &dof_values,
+                  OpenRAVE::Transform const &transform);
+
+private:
+    OpenRAVE::EnvironmentBasePtr env_;
+    OpenRAVE::RobotBasePtr robot_;
+};
+
+}
+}
+
+#endif
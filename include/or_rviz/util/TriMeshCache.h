@@ -0,0 +1,163 @@
+#ifndef TRIMESHCACHE_H_
+#define TRIMESHCACHE_H_
+#include <deque>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <boost/unordered_map.hpp>
+#include <geometry_msgs/Point.h>
+// workaround for qt moc bug w.r.t. BOOST_JOIN macro
+// see https://bugreports.qt.io/browse/QTBUG-22829
+#ifndef Q_MOC_RUN
+    #include <openrave/openrave.h>
+#endif
+
+namespace or_rviz {
+namespace util {
+
+// Process-wide cache of TriMeshes converted into TRIANGLE_LIST points.
+//
+// Every LinkMarker that displays the same geometry (e.g. a robot and its
+// ghost manipulator) shares one converted point list. Rebuilding a marker,
+// e.g. after a color or visibility change, copies the cached list instead of
+// walking the mesh again.
+//
+// Large meshes can also be requested with a triangle budget. The first such
+// request simplifies the mesh into a series of level of detail (LOD) tiers,
+// each about kLodReduction times smaller than the last, and every request
+// returns the most detailed tier that fits its budget.
+class TriMeshCache {
+public:
+    typedef std::vector<geometry_msgs::Point> PointList;
+    typedef boost::shared_ptr<PointList const> PointListConstPtr;
+
+    static TriMeshCache &instance();
+
+    static size_t const kLodReduction;
+    static double const kFailureLifetime;
+    static size_t const kMinLodTriangles;
+
+    // Points for the collision mesh of a geometry. The entry is discarded
+    // once the geometry is destroyed. A max_triangles of zero returns the
+    // full mesh. The mesh is converted immediately, but simplifying it is
+    // slow, so any LOD tiers needed to meet max_triangles are built on a
+    // worker thread. Until they are ready this returns NULL and sets
+    // is_pending.
+    PointListConstPtr GetCollisionMeshAsync(
+        OpenRAVE::KinBody::Link::GeometryPtr const &geometry,
+        size_t max_triangles, bool *is_pending);
+    bool IsCollisionMeshPending(
+        OpenRAVE::KinBody::Link::GeometryPtr const &geometry);
+
+    // Drops the collision meshes of every geometry in a body. Collision
+    // meshes are cached by address, and SetCollisionMesh modifies the mesh in
+    // place, so this must be called when the body's geometry changes.
+    void EvictCollisionMeshes(OpenRAVE::KinBody const &body);
+
+    // Points for a mesh file loaded by OpenRAVE on a worker thread. Returns
+    // NULL and sets is_pending until the mesh finishes loading, including
+    // building its LOD tiers if they are needed to meet max_triangles. Also
+    // returns NULL if OpenRAVE is unable to load the file; failures are
+    // cached for kFailureLifetime seconds before the file is tried again.
+    PointListConstPtr GetRenderMeshAsync(OpenRAVE::EnvironmentBasePtr const &env,
+                                         std::string const &uri,
+                                         OpenRAVE::Vector const &scale,
+                                         size_t max_triangles,
+                                         bool *is_pending);
+    bool IsRenderMeshPending(std::string const &uri,
+                             OpenRAVE::Vector const &scale);
+
+    void Clear();
+
+    static void ConvertTriMesh(OpenRAVE::TriMesh const &trimesh,
+                               PointList *points);
+
+    // Simplified versions of a mesh, from most to least detailed.
+    static void BuildLods(PointList const &points,
+                          std::vector<PointListConstPtr> *lods);
+
+private:
+    static size_t const kMaxWorkers;
+    static size_t const kMinPruneInterval;
+
+    struct Key {
+        Key();
+        Key(void const *mesh, std::string const &uri,
+            OpenRAVE::Vector const &scale);
+
+        bool operator==(Key const &other) const;
+
+        void const *mesh;
+        std::string uri;
+        OpenRAVE::dReal scale[3];
+    };
+
+    struct KeyHash {
+        size_t operator()(Key const &key) const;
+    };
+
+    struct Entry {
+        Entry() : has_owner(false), has_expiry(false), is_pending(false),
+                  has_lods(false), load_id(0) { }
+
+        bool has_owner;
+        bool has_expiry;
+        bool is_pending;
+        bool has_lods;
+        size_t load_id;
+        boost::weak_ptr<void const> owner;
+        boost::system_time expiry;
+        PointListConstPtr points;
+        std::vector<PointListConstPtr> lods;
+    };
+
+    struct LoadRequest {
+        Key key;
+        boost::weak_ptr<OpenRAVE::EnvironmentBase> env;
+        size_t max_triangles;
+        size_t load_id;
+    };
+
+    typedef boost::unordered_map<Key, Entry, KeyHash> EntryMap;
+
+    boost::mutex mutex_;
+    EntryMap entries_;
+    size_t num_inserts_;
+    size_t prune_interval_;
+
+    size_t next_load_id_;
+    bool stopping_;
+    boost::thread_group workers_;
+    boost::condition_variable requests_condition_;
+    std::deque<LoadRequest> requests_;
+
+    TriMeshCache();
+    ~TriMeshCache();
+
+    static bool IsExpired(Entry const &entry);
+    bool Find(Key const &key, Entry *entry);
+    void Insert(Key const &key, Entry const &entry);
+    void InsertLocked(Key const &key, Entry const &entry);
+    void Queue(Key const &key, Entry entry,
+               boost::weak_ptr<OpenRAVE::EnvironmentBase> const &env,
+               size_t max_triangles);
+    void WorkerThread();
+
+    static bool NeedsLods(Entry const &entry, size_t max_triangles);
+    static PointListConstPtr SelectLod(Entry const &entry, size_t max_triangles);
+    // Sets the points of a mesh file, and its LOD tiers if they are in the
+    // disk cache. Returns true only if OpenRAVE loaded the mesh, i.e. there
+    // is something new to write to the disk cache.
+    static bool LoadRenderMesh(
+        OpenRAVE::EnvironmentBasePtr const &env, std::string const &uri,
+        OpenRAVE::Vector const &scale, Entry *entry);
+};
+
+}
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef VERTEXNORMALS_H_
+#define VERTEXNORMALS_H_
+#include <cstddef>
+
+namespace or_rviz {
+namespace util {
+
+extern size_t const kParallelNormalThreshold;
+
+// Angle-weighted vertex normals of an indexed triangle mesh. Vertices and
+// normals are packed XYZ triples, e.g. the contents of a vector of
+// Ogre::Vector3. Vertices that no triangle uses get a zero normal.
+//
+// Face normals and corner angles are computed four triangles at a time with
+// SSE2, when available. acos is replaced by a polynomial approximation with
+// an error below 1e-4 radians. Meshes with more than
+// kParallelNormalThreshold triangles split this work across threads.
+void ComputeVertexNormals(float const *vertices, size_t num_vertices,
+                          int const *indices, size_t num_triangles,
+                          float *normals);
+
+}
+}
+
+#endif
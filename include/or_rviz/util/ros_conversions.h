@@ -31,6 +31,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 *************************************************************************/
 #ifndef ROS_CONVERSIONS_H_
 #define ROS_CONVERSIONS_H_
+#include <vector>
 #include <std_msgs/ColorRGBA.h>
 #include <geometry_msgs/Pose.h>
 #include <geometry_msgs/Point.h>
@@ -59,6 +60,18 @@ geometry_msgs::Point toROSPoint(OpenRAVE::RaveVector<Scalar> const &or_point);
 template <class Scalar>
 geometry_msgs::Quaternion toROSQuaternion(OpenRAVE::RaveVector<Scalar> const &or_quat);
 
+// Bulk conversion of the float arrays passed to OpenRAVE's plotting
+// functions. The stride between points is in bytes. Colors are packed RGB
+// or RGBA triples; alpha defaults to one. Colors use SSE2 when available.
+void toROSPoints(float const *points, int num_points, int stride,
+                 std::vector<geometry_msgs::Point> *out_points);
+void toROSColors(float const *colors, int num_colors, bool has_alpha,
+                 std::vector<std_msgs::ColorRGBA> *out_colors);
+// Expands an indexed mesh into TRIANGLE_LIST points, three per triangle.
+void toROSMeshPoints(float const *points, int stride,
+                     int const *indices, int num_triangles,
+                     std::vector<geometry_msgs::Point> *out_points);
+
 // ROS to OpenRAVE
 template <class Scalar>
 OpenRAVE::RaveVector<Scalar> toORPoint(geometry_msgs::Point const &point);
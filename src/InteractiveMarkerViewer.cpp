@@ -29,16 +29,21 @@ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 *************************************************************************/
+#include <cmath>
+#include <utility>
 #include <boost/format.hpp>
 #include <boost/make_shared.hpp>
 #include <boost/algorithm/string/trim.hpp>
+#include <boost/range/adaptor/map.hpp>
 #include <interactive_markers/interactive_marker_server.h>
+#include "util/MeshDiskCache.h"
 #include "util/ScopedConnection.h"
 #include "util/ros_conversions.h"
 #include "InteractiveMarkerViewer.h"
 
 using boost::format;
 using boost::str;
+using boost::adaptors::map_values;
 using interactive_markers::InteractiveMarkerServer;
 using visualization_msgs::InteractiveMarker;
 using visualization_msgs::InteractiveMarkerPtr;
@@ -53,6 +58,20 @@ typedef boost::shared_ptr<interactive_markers::InteractiveMarkerServer> Interact
 static double const kRefreshRate = 30;
 static double const kWidthScaleFactor = 100;
 
+// Number of syncs between scans for bodies that are missing a KinBodyMarker.
+static size_t const kDiscoveryPeriod = 30;
+
+// Default time each sync may spend rebuilding geometry, in seconds. This
+// leaves some headroom in a 30 Hz refresh for the rest of the UI.
+static double const kDefaultSyncBudget = 0.02;
+
+// Graphs with more points than this get their own marker. Batching them
+// gains little and every change would re-send the other graphs in the batch.
+static size_t const kMaxBatchedGraphPoints = 1024;
+
+// Number of sides used to approximate the cylinders of a batched arrow.
+static int const kArrowSides = 8;
+
 namespace or_rviz {
 
 namespace {
@@ -77,8 +96,21 @@ InteractiveMarkerViewer::InteractiveMarkerViewer(
     , running_(false)
     , do_sync_(true)
     , topic_name_(topic_name)
+    , marker_array_topic_name_(str(format("%s/markers") % topic_name))
     , server_(boost::make_shared<InteractiveMarkerServer>(topic_name))
+    , graph_batcher_(boost::make_shared<GraphBatcher>(server_))
+    , graph_batching_(true)
+    , plain_publisher_(boost::make_shared<MarkerArrayPublisher>(marker_array_topic_name_))
+    , dirty_tracking_(true)
+    , sync_count_(0)
+    , sync_budget_(kDefaultSyncBudget)
+    , parent_frame_id_changed_(false)
     , parent_frame_id_(kDefaultWorldFrameId)
+    , pose_epsilon_(LinkMarker::kDefaultPoseEpsilon)
+    , triangle_budget_changed_(false)
+    , triangle_budget_(0)
+    , interactive_changed_(false)
+    , interactive_policy_(InteractiveAll)
     , pixels_to_meters_(0.001)
 {
     BOOST_ASSERT(env);
@@ -91,10 +123,72 @@ InteractiveMarkerViewer::InteractiveMarkerViewer(
         boost::bind(&InteractiveMarkerViewer::GetMenuSelectionCommand, this, _1, _2),
         "Get the name of the last menu selection."
     );
+    RegisterCommand("SetDirtyTracking",
+        boost::bind(&InteractiveMarkerViewer::SetDirtyTrackingCommand, this, _1, _2),
+        "Only sync bodies that changed since the last update (default: 1)."
+    );
+    RegisterCommand("SetPoseEpsilon",
+        boost::bind(&InteractiveMarkerViewer::SetPoseEpsilonCommand, this, _1, _2),
+        "Minimum change in a link pose that is published to RViz."
+    );
+    RegisterCommand("SetMeshCacheDirectory",
+        boost::bind(&InteractiveMarkerViewer::SetMeshCacheDirectoryCommand, this, _1, _2),
+        "Cache meshes loaded by OpenRAVE in this directory (empty to disable)."
+    );
+    RegisterCommand("SetSyncBudget",
+        boost::bind(&InteractiveMarkerViewer::SetSyncBudgetCommand, this, _1, _2),
+        "Seconds per update spent rebuilding geometry (default: 0.02, 0 for no limit)."
+    );
+    RegisterCommand("SetTriangleBudget",
+        boost::bind(&InteractiveMarkerViewer::SetTriangleBudgetCommand, this, _1, _2),
+        "Show meshes with more triangles than this at a simplified level of"
+        " detail (default: 0 for no limit)."
+    );
+    RegisterCommand("SetGraphBatching",
+        boost::bind(&InteractiveMarkerViewer::SetGraphBatchingCommand, this, _1, _2),
+        "Pack small graphs into shared markers (default: 1)."
+    );
+    RegisterCommand("SetPlotDecimation",
+        boost::bind(&InteractiveMarkerViewer::SetPlotDecimationCommand, this, _1, _2),
+        "Thin plot3 point clouds to one point per voxel and at most a fixed"
+        " number of points. Expects a voxel size and a point budget; zero"
+        " disables either (default: 0 0)."
+    );
+    RegisterCommand("GetPlotDecimationStats",
+        boost::bind(&InteractiveMarkerViewer::GetPlotDecimationStatsCommand, this, _1, _2),
+        "Print the number of points passed to plot3 and the number dropped by"
+        " decimation."
+    );
+    RegisterCommand("SetInteractivePolicy",
+        boost::bind(&InteractiveMarkerViewer::SetInteractivePolicyCommand, this, _1, _2),
+        "Choose which bodies have link menus: \"all\", \"robots\", or \"none\"."
+        " Other bodies are published as plain markers on <topic>/markers"
+        " (default: all)."
+    );
+    RegisterCommand("SetBodyInteractive",
+        boost::bind(&InteractiveMarkerViewer::SetBodyInteractiveCommand, this, _1, _2),
+        "Override the interactive policy for a body. Expects a body name and"
+        " 1, 0, or \"default\"."
+    );
 
     set_environment(env);
 }
 
+InteractiveMarkerViewer::~InteractiveMarkerViewer()
+{
+    // The KinBodyMarkers are owned by the bodies, so they may outlive us.
+    std::vector<OpenRAVE::KinBodyPtr> bodies;
+    env_->GetBodies(bodies);
+
+    for (OpenRAVE::KinBodyPtr const &body : bodies) {
+        OpenRAVE::UserDataPtr const raw = body->GetUserData("interactive_marker");
+        auto const body_marker = boost::dynamic_pointer_cast<KinBodyMarker>(raw);
+        if (body_marker) {
+            body_marker->set_dirty_callback(boost::function<void ()>());
+        }
+    }
+}
+
 void InteractiveMarkerViewer::set_environment(
     OpenRAVE::EnvironmentBasePtr const &env)
 {
@@ -137,11 +231,96 @@ void InteractiveMarkerViewer::set_parent_frame(std::string const &frame_id)
             parent_frame_id_.c_str(), frame_id.c_str());
     }
 
+    parent_frame_id_changed_ = parent_frame_id_changed_ || (frame_id != parent_frame_id_);
     parent_frame_id_ = frame_id;
 
     // TODO: Also re-create any visualization markers in the correct frame.
 }
 
+void InteractiveMarkerViewer::set_dirty_tracking(bool enabled)
+{
+    RAVELOG_DEBUG("Set dirty tracking to %d.\n", enabled);
+    dirty_tracking_ = enabled;
+}
+
+void InteractiveMarkerViewer::set_pose_epsilon(double epsilon)
+{
+    if (epsilon < 0.) {
+        throw OpenRAVE::openrave_exception(str(
+            format("Pose epsilon must be non-negative; got %f.") % epsilon),
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    RAVELOG_DEBUG("Set pose epsilon to %f.\n", epsilon);
+    pose_epsilon_ = epsilon;
+}
+
+void InteractiveMarkerViewer::set_sync_budget(double budget)
+{
+    if (budget < 0.) {
+        throw OpenRAVE::openrave_exception(str(
+            format("Sync budget must be non-negative; got %f.") % budget),
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    RAVELOG_DEBUG("Set sync budget to %f seconds.\n", budget);
+    sync_budget_ = budget;
+}
+
+void InteractiveMarkerViewer::set_triangle_budget(size_t max_triangles)
+{
+    RAVELOG_DEBUG("Set triangle budget to %d.\n", static_cast<int>(max_triangles));
+    triangle_budget_changed_ = triangle_budget_changed_
+                            || (max_triangles != triangle_budget_);
+    triangle_budget_ = max_triangles;
+}
+
+void InteractiveMarkerViewer::set_graph_batching(bool enabled)
+{
+    RAVELOG_DEBUG("Set graph batching to %d.\n", enabled);
+    graph_batching_ = enabled;
+}
+
+void InteractiveMarkerViewer::set_plot_decimation(double voxel_size,
+                                                  size_t point_budget)
+{
+    RAVELOG_DEBUG("Set plot decimation to a voxel size of %f and a budget of"
+                  " %d points.\n", voxel_size, static_cast<int>(point_budget));
+    plot_decimator_.set_voxel_size(voxel_size);
+    plot_decimator_.set_point_budget(point_budget);
+}
+
+void InteractiveMarkerViewer::set_interactive_policy(InteractivePolicy policy)
+{
+    RAVELOG_DEBUG("Set interactive policy to %d.\n", policy);
+
+    boost::mutex::scoped_lock interactive_lock(interactive_mutex_);
+    interactive_changed_ = interactive_changed_ || (policy != interactive_policy_);
+    interactive_policy_ = policy;
+}
+
+void InteractiveMarkerViewer::set_body_interactive(std::string const &body_name,
+                                                   bool interactive)
+{
+    RAVELOG_DEBUG("Set interactive to %d for '%s'.\n",
+        interactive, body_name.c_str());
+
+    boost::mutex::scoped_lock interactive_lock(interactive_mutex_);
+    interactive_overrides_[body_name] = interactive;
+    interactive_changed_ = true;
+}
+
+void InteractiveMarkerViewer::clear_body_interactive(std::string const &body_name)
+{
+    RAVELOG_DEBUG("Cleared interactive override for '%s'.\n", body_name.c_str());
+
+    boost::mutex::scoped_lock interactive_lock(interactive_mutex_);
+    interactive_changed_ = interactive_changed_
+                        || interactive_overrides_.erase(body_name) > 0;
+}
+
 int InteractiveMarkerViewer::main(bool bShow)
 {
     ros::Rate rate(kRefreshRate);
@@ -180,35 +359,223 @@ void InteractiveMarkerViewer::EnvironmentSync()
         return;
     }
 
-    std::vector<KinBodyPtr> bodies;
-    env_->GetBodies(bodies);
+    ros::WallTime const sync_start = ros::WallTime::now();
+
+    bool interactive_changed;
+    {
+        boost::mutex::scoped_lock interactive_lock(interactive_mutex_);
+        interactive_changed = interactive_changed_;
+        interactive_changed_ = false;
+    }
 
+    // Changing the parent frame, the triangle budget, or which bodies are
+    // interactive touches every marker, so we may as well visit every body.
+    if (!dirty_tracking_ || parent_frame_id_changed_ || triangle_budget_changed_
+            || interactive_changed) {
+        SyncAllBodies(sync_start);
+        parent_frame_id_changed_ = false;
+        triangle_budget_changed_ = false;
+    } else {
+        if (sync_count_ % kDiscoveryPeriod == 0) {
+            DiscoverBodies();
+        }
+        SyncDirtyBodies(sync_start);
+    }
+    ++sync_count_;
+
+    // Update any graph handles. This publishes any streaming updates made
+    // since the last sync.
+    {
+        boost::mutex::scoped_lock graph_lock(graph_handles_mutex_);
+        for (util::InteractiveMarkerGraphHandle *const handle : graph_handles_) {
+            handle->set_parent_frame(parent_frame_id_);
+            handle->Flush();
+        }
+    }
+    graph_batcher_->set_parent_frame(parent_frame_id_);
+    graph_batcher_->Flush();
+
+    plain_publisher_->Flush();
+    server_->applyChanges();
+    ros::spinOnce();
+}
+
+bool InteractiveMarkerViewer::IsOverBudget(ros::WallTime const &sync_start) const
+{
+    return sync_budget_ > 0.
+        && (ros::WallTime::now() - sync_start).toSec() > sync_budget_;
+}
+
+KinBodyMarkerPtr InteractiveMarkerViewer::FindBodyMarker(KinBodyPtr const &body) const
+{
+    OpenRAVE::UserDataPtr const raw = body->GetUserData("interactive_marker");
+    return boost::dynamic_pointer_cast<KinBodyMarker>(raw);
+}
+
+KinBodyMarkerPtr InteractiveMarkerViewer::GetBodyMarker(KinBodyPtr const &body)
+{
+    OpenRAVE::UserDataPtr raw = body->GetUserData("interactive_marker"); 
+    auto body_marker = boost::dynamic_pointer_cast<KinBodyMarker>(raw);
+
+    // It's possibe to get here without the body's KinBodyMarker being
+    // fully initialized due to a race condition and/or environment
+    // cloning, which doesn't call BodyCallback.
+    if (!body_marker) {
+        BodyCallback(body, 1);
+
+        raw = body->GetUserData("interactive_marker"); 
+        body_marker = boost::dynamic_pointer_cast<KinBodyMarker>(raw);
+        BOOST_ASSERT(body_marker);
+    }
+    return body_marker;
+}
+
+bool InteractiveMarkerViewer::IsBodyInteractive(KinBodyPtr const &body)
+{
+    boost::mutex::scoped_lock interactive_lock(interactive_mutex_);
+
+    auto const it = interactive_overrides_.find(body->GetName());
+    if (it != interactive_overrides_.end()) {
+        return it->second;
+    }
+
+    switch (interactive_policy_) {
+    case InteractiveAll:
+        return true;
+    case InteractiveRobots:
+        return body->IsRobot();
+    case InteractiveNone:
+        return false;
+    }
+    return true;
+}
+
+void InteractiveMarkerViewer::SyncBody(KinBodyPtr const &body,
+                                       KinBodyMarkerPtr const &body_marker)
+{
+    body_marker->set_parent_frame(parent_frame_id_);
+    body_marker->set_pose_epsilon(pose_epsilon_);
+    body_marker->set_triangle_budget(triangle_budget_);
+    body_marker->set_plain_publisher(
+        IsBodyInteractive(body) ? MarkerArrayPublisherPtr() : plain_publisher_);
+    body_marker->EnvironmentSync();
+
+    // Keep active bodies queued. This also keeps them queued in case we
+    // switch from a full sync to dirty tracking.
+    if (body_marker->is_active()) {
+        BodyChangedCallback(body);
+    }
+}
+
+void InteractiveMarkerViewer::SyncBodies(std::vector<KinBodyPtr> const &bodies,
+                                         ros::WallTime const &sync_start)
+{
+    typedef std::pair<KinBodyPtr, KinBodyMarkerPtr> BodyAndMarker;
+
+    // Bodies that were deferred by the last sync go first, so a steady
+    // stream of changes can't starve them.
+    boost::unordered_set<OpenRAVE::KinBody *> visited;
+    std::vector<BodyAndMarker> rebuild_bodies;
+
+    for (OpenRAVE::KinBodyWeakPtr const &weak_body : deferred_bodies_) {
+        KinBodyPtr const body = weak_body.lock();
+        if (!body || !visited.insert(body.get()).second) {
+            continue;
+        }
+
+        KinBodyMarkerPtr const body_marker = FindBodyMarker(body);
+        if (body_marker) {
+            rebuild_bodies.push_back(std::make_pair(body, body_marker));
+        }
+    }
+    deferred_bodies_.clear();
+
+    // Pose updates are cheap and are what the user notices lagging, so they
+    // are always synced. Bodies that need new geometry wait for phase two.
     for (KinBodyPtr const &body : bodies) {
-        OpenRAVE::UserDataPtr raw = body->GetUserData("interactive_marker"); 
-        auto body_marker = boost::dynamic_pointer_cast<KinBodyMarker>(raw);
+        if (!visited.insert(body.get()).second) {
+            continue;
+        }
 
-        // It's possibe to get here without the body's KinBodyMarker being
-        // fully initialized due to a race condition and/or environment
-        // cloning, which doesn't call BodyCallback.
+        // Bodies removed from the environment no longer have a marker. Don't
+        // create a new one; DiscoverBodies handles any that are missing.
+        KinBodyMarkerPtr const body_marker = FindBodyMarker(body);
         if (!body_marker) {
-            BodyCallback(body, 1);
+            continue;
+        } else if (body_marker->has_geometry_changes()) {
+            rebuild_bodies.push_back(std::make_pair(body, body_marker));
+        } else {
+            SyncBody(body, body_marker);
+        }
+    }
 
-            raw = body->GetUserData("interactive_marker"); 
-            body_marker = boost::dynamic_pointer_cast<KinBodyMarker>(raw);
-            BOOST_ASSERT(body_marker);
+    // Rebuild geometry until we run out of time. We always make progress on
+    // at least one body, even if the pose updates used up the budget.
+    for (size_t i = 0; i < rebuild_bodies.size(); ++i) {
+        if (i > 0 && IsOverBudget(sync_start)) {
+            for (size_t j = i; j < rebuild_bodies.size(); ++j) {
+                deferred_bodies_.push_back(rebuild_bodies[j].first);
+            }
+
+            RAVELOG_DEBUG("Deferred geometry updates for %d bodies to the"
+                          " next sync.\n", static_cast<int>(deferred_bodies_.size()));
+            break;
         }
 
-        body_marker->set_parent_frame(parent_frame_id_);
-        body_marker->EnvironmentSync();
+        SyncBody(rebuild_bodies[i].first, rebuild_bodies[i].second);
     }
+}
 
-    // Update any graph handles.
-    for (util::InteractiveMarkerGraphHandle *const handle : graph_handles_) {
-        handle->set_parent_frame(parent_frame_id_);
+void InteractiveMarkerViewer::SyncAllBodies(ros::WallTime const &sync_start)
+{
+    // Everything is about to be synced, so there is nothing left to do.
+    {
+        boost::mutex::scoped_lock dirty_lock(dirty_mutex_);
+        dirty_bodies_.clear();
     }
 
-    server_->applyChanges();
-    ros::spinOnce();
+    std::vector<KinBodyPtr> bodies;
+    env_->GetBodies(bodies);
+
+    for (KinBodyPtr const &body : bodies) {
+        GetBodyMarker(body);
+    }
+
+    SyncBodies(bodies, sync_start);
+}
+
+void InteractiveMarkerViewer::SyncDirtyBodies(ros::WallTime const &sync_start)
+{
+    // Swap the queue out before syncing. Syncing a body may modify it, which
+    // fires its change callbacks and re-queues it for the next sync.
+    boost::unordered_map<OpenRAVE::KinBody *, OpenRAVE::KinBodyWeakPtr> dirty_bodies;
+    {
+        boost::mutex::scoped_lock dirty_lock(dirty_mutex_);
+        dirty_bodies.swap(dirty_bodies_);
+    }
+
+    std::vector<KinBodyPtr> bodies;
+    bodies.reserve(dirty_bodies.size());
+
+    for (OpenRAVE::KinBodyWeakPtr const &weak_body : dirty_bodies | map_values) {
+        if (KinBodyPtr const body = weak_body.lock()) {
+            bodies.push_back(body);
+        }
+    }
+
+    SyncBodies(bodies, sync_start);
+}
+
+void InteractiveMarkerViewer::DiscoverBodies()
+{
+    std::vector<KinBodyPtr> bodies;
+    env_->GetBodies(bodies);
+
+    for (KinBodyPtr const &body : bodies) {
+        if (!FindBodyMarker(body)) {
+            BodyCallback(body, 1);
+        }
+    }
 }
 
 void InteractiveMarkerViewer::SetEnvironmentSync(bool do_update)
@@ -256,9 +623,10 @@ GraphHandlePtr InteractiveMarkerViewer::plot3(
         );
     }
 
-    ConvertPoints(points, num_points, stride, &marker.points);
+    toROSPoints(points, num_points, stride, &marker.points);
+    DecimatePlot(&marker);
 
-    return CreateGraphHandle(interactive_marker);
+    return CreateGraph(interactive_marker);
 }
 
 OpenRAVE::GraphHandlePtr InteractiveMarkerViewer::plot3(
@@ -286,10 +654,11 @@ OpenRAVE::GraphHandlePtr InteractiveMarkerViewer::plot3(
         );
     }
 
-    ConvertPoints(points, num_points, stride, &marker.points);
-    ConvertColors(colors, num_points, has_alpha, &marker.colors);
+    toROSPoints(points, num_points, stride, &marker.points);
+    toROSColors(colors, num_points, has_alpha, &marker.colors);
+    DecimatePlot(&marker);
 
-    return CreateGraphHandle(interactive_marker);
+    return CreateGraph(interactive_marker);
 }
 
 GraphHandlePtr InteractiveMarkerViewer::drawarrow(
@@ -309,7 +678,7 @@ GraphHandlePtr InteractiveMarkerViewer::drawarrow(
     marker.points.push_back(toROSPoint(p2));
 
 
-    return CreateGraphHandle(interactive_marker);
+    return CreateGraph(interactive_marker);
 }
 
 GraphHandlePtr InteractiveMarkerViewer::drawlinestrip(
@@ -322,9 +691,9 @@ GraphHandlePtr InteractiveMarkerViewer::drawlinestrip(
     marker.color = toROSColor<>(color);
     marker.scale.x = width * pixels_to_meters_;
 
-    ConvertPoints(points, num_points, stride, &marker.points);
+    toROSPoints(points, num_points, stride, &marker.points);
 
-    return CreateGraphHandle(interactive_marker);
+    return CreateGraph(interactive_marker);
 }
 
 GraphHandlePtr InteractiveMarkerViewer::drawlinestrip(
@@ -336,10 +705,10 @@ GraphHandlePtr InteractiveMarkerViewer::drawlinestrip(
     marker.type = visualization_msgs::Marker::LINE_STRIP;
     marker.scale.x = width * pixels_to_meters_;
 
-    ConvertPoints(points, num_points, stride, &marker.points);
-    ConvertColors(colors, num_points, false, &marker.colors);
+    toROSPoints(points, num_points, stride, &marker.points);
+    toROSColors(colors, num_points, false, &marker.colors);
 
-    return CreateGraphHandle(interactive_marker);
+    return CreateGraph(interactive_marker);
 }
 
 GraphHandlePtr InteractiveMarkerViewer::drawlinelist(
@@ -352,9 +721,9 @@ GraphHandlePtr InteractiveMarkerViewer::drawlinelist(
     marker.color = toROSColor<>(color);
     marker.scale.x = width / kWidthScaleFactor;
 
-    ConvertPoints(points, num_points, stride, &marker.points);
+    toROSPoints(points, num_points, stride, &marker.points);
 
-    return CreateGraphHandle(interactive_marker);
+    return CreateGraph(interactive_marker);
 }
 
 GraphHandlePtr InteractiveMarkerViewer::drawlinelist(
@@ -366,10 +735,10 @@ GraphHandlePtr InteractiveMarkerViewer::drawlinelist(
     marker.type = visualization_msgs::Marker::LINE_LIST;
     marker.scale.x = width / kWidthScaleFactor;
 
-    ConvertPoints(points, num_points, stride, &marker.points);
-    ConvertColors(colors, num_points, false, &marker.colors);
+    toROSPoints(points, num_points, stride, &marker.points);
+    toROSColors(colors, num_points, false, &marker.colors);
 
-    return CreateGraphHandle(interactive_marker);
+    return CreateGraph(interactive_marker);
 }
 
 GraphHandlePtr InteractiveMarkerViewer::drawbox(
@@ -382,7 +751,7 @@ GraphHandlePtr InteractiveMarkerViewer::drawbox(
     marker.pose.position = toROSPoint<>(pos);
     marker.scale = toROSVector<>(2.0 * extents);
 
-    return CreateGraphHandle(interactive_marker);
+    return CreateGraph(interactive_marker);
 }
 
 OpenRAVE::GraphHandlePtr InteractiveMarkerViewer::drawplane(
@@ -408,9 +777,9 @@ GraphHandlePtr InteractiveMarkerViewer::drawtrimesh(
     marker.scale.y = 1;
     marker.scale.z = 1;
 
-    ConvertMesh(points, stride, indices, num_triangles, &marker.points);
+    toROSMeshPoints(points, stride, indices, num_triangles, &marker.points);
 
-    return CreateGraphHandle(interactive_marker);
+    return CreateGraph(interactive_marker);
 }
 
 GraphHandlePtr InteractiveMarkerViewer::drawtrimesh(
@@ -425,7 +794,7 @@ GraphHandlePtr InteractiveMarkerViewer::drawtrimesh(
     marker.scale.z = 1;
 
 
-    ConvertMesh(points, stride, indices, num_triangles, &marker.points);
+    toROSMeshPoints(points, stride, indices, num_triangles, &marker.points);
 
     // TODO: Colors should be per-vertex, not per-face.
     size_t const *color_shape = colors.shape();
@@ -446,6 +815,7 @@ GraphHandlePtr InteractiveMarkerViewer::drawtrimesh(
         );
     }
 
+    // toROSMeshPoints emits three consecutive points per triangle.
     marker.colors.resize(3 * num_triangles);
     for (int itri = 0; itri < num_triangles; ++itri) {
         std_msgs::ColorRGBA color;
@@ -460,13 +830,11 @@ GraphHandlePtr InteractiveMarkerViewer::drawtrimesh(
         }
 
         for (int ivertex = 0; ivertex < 3; ++ivertex) {
-            int const index_offset = 3 * itri + ivertex;
-            int const index = stride * indices[index_offset];
-            marker.colors[index] = color;
+            marker.colors[3 * itri + ivertex] = color;
         }
     }
 
-    return CreateGraphHandle(interactive_marker);
+    return CreateGraph(interactive_marker);
 }
 
 bool InteractiveMarkerViewer::AddMenuEntryCommand(std::ostream &out,
@@ -557,6 +925,7 @@ bool InteractiveMarkerViewer::AddMenuEntryCommand(std::ostream &out,
 void InteractiveMarkerViewer::GraphHandleRemovedCallback(
         util::InteractiveMarkerGraphHandle *handle)
 {
+    boost::mutex::scoped_lock graph_lock(graph_handles_mutex_);
     graph_handles_.erase(handle);
 }
 
@@ -566,6 +935,177 @@ bool InteractiveMarkerViewer::GetMenuSelectionCommand(std::ostream &out,
     out << menu_queue_.rdbuf();
 }
 
+bool InteractiveMarkerViewer::SetDirtyTrackingCommand(std::ostream &out,
+                                                      std::istream &in)
+{
+    bool enabled;
+    in >> enabled;
+
+    if (in.fail()) {
+        throw OpenRAVE::openrave_exception(
+            "SetDirtyTracking expects a boolean argument.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    set_dirty_tracking(enabled);
+    return true;
+}
+
+bool InteractiveMarkerViewer::SetPoseEpsilonCommand(std::ostream &out,
+                                                   std::istream &in)
+{
+    double epsilon;
+    in >> epsilon;
+
+    if (in.fail()) {
+        throw OpenRAVE::openrave_exception(
+            "SetPoseEpsilon expects a numeric argument.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    set_pose_epsilon(epsilon);
+    return true;
+}
+
+bool InteractiveMarkerViewer::SetMeshCacheDirectoryCommand(std::ostream &out,
+                                                           std::istream &in)
+{
+    std::string const directory = GetRemainingContent(in, true);
+    MeshDiskCache::instance().set_directory(directory);
+    return true;
+}
+
+bool InteractiveMarkerViewer::SetSyncBudgetCommand(std::ostream &out,
+                                                  std::istream &in)
+{
+    double budget;
+    in >> budget;
+
+    if (in.fail()) {
+        throw OpenRAVE::openrave_exception(
+            "SetSyncBudget expects a numeric argument.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    set_sync_budget(budget);
+    return true;
+}
+
+bool InteractiveMarkerViewer::SetTriangleBudgetCommand(std::ostream &out,
+                                                      std::istream &in)
+{
+    int max_triangles;
+    in >> max_triangles;
+
+    if (in.fail() || max_triangles < 0) {
+        throw OpenRAVE::openrave_exception(
+            "SetTriangleBudget expects a non-negative integer argument.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    set_triangle_budget(max_triangles);
+    return true;
+}
+
+bool InteractiveMarkerViewer::SetGraphBatchingCommand(std::ostream &out,
+                                                     std::istream &in)
+{
+    bool enabled;
+    in >> enabled;
+
+    if (in.fail()) {
+        throw OpenRAVE::openrave_exception(
+            "SetGraphBatching expects a boolean argument.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    set_graph_batching(enabled);
+    return true;
+}
+
+bool InteractiveMarkerViewer::SetPlotDecimationCommand(std::ostream &out,
+                                                      std::istream &in)
+{
+    double voxel_size;
+    int point_budget;
+    in >> voxel_size >> point_budget;
+
+    if (in.fail() || voxel_size < 0 || point_budget < 0) {
+        throw OpenRAVE::openrave_exception(
+            "SetPlotDecimation expects a non-negative voxel size and point"
+            " budget.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    set_plot_decimation(voxel_size, point_budget);
+    return true;
+}
+
+bool InteractiveMarkerViewer::GetPlotDecimationStatsCommand(std::ostream &out,
+                                                           std::istream &in)
+{
+    out << plot_decimator_.num_input_points() << " "
+        << plot_decimator_.num_dropped_points();
+    return true;
+}
+
+bool InteractiveMarkerViewer::SetInteractivePolicyCommand(std::ostream &out,
+                                                          std::istream &in)
+{
+    std::string policy;
+    in >> policy;
+
+    if (policy == "all") {
+        set_interactive_policy(InteractiveAll);
+    } else if (policy == "robots") {
+        set_interactive_policy(InteractiveRobots);
+    } else if (policy == "none") {
+        set_interactive_policy(InteractiveNone);
+    } else {
+        throw OpenRAVE::openrave_exception(str(
+            format("Unknown interactive policy '%s'; expected \"all\","
+                   " \"robots\", or \"none\".") % policy),
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+    return true;
+}
+
+bool InteractiveMarkerViewer::SetBodyInteractiveCommand(std::ostream &out,
+                                                        std::istream &in)
+{
+    std::string body_name, value;
+    in >> body_name >> value;
+
+    if (in.fail()) {
+        throw OpenRAVE::openrave_exception(
+            "SetBodyInteractive expects a body name and 1, 0, or \"default\".",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    if (value == "1") {
+        set_body_interactive(body_name, true);
+    } else if (value == "0") {
+        set_body_interactive(body_name, false);
+    } else if (value == "default") {
+        clear_body_interactive(body_name);
+    } else {
+        throw OpenRAVE::openrave_exception(str(
+            format("Invalid value '%s' for SetBodyInteractive; expected 1, 0,"
+                   " or \"default\".") % value),
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+    return true;
+}
+
 void InteractiveMarkerViewer::BodyCallback(OpenRAVE::KinBodyPtr body, int flag)
 {
     RAVELOG_DEBUG("BodyCallback %s -> %d\n", body->GetName().c_str(), flag);
@@ -574,12 +1114,31 @@ void InteractiveMarkerViewer::BodyCallback(OpenRAVE::KinBodyPtr body, int flag)
     if (flag == 1) {
         auto const body_marker = boost::make_shared<KinBodyMarker>(server_, body);
         body_marker->set_parent_frame(parent_frame_id_);
+        body_marker->set_dirty_callback(
+            boost::bind(&InteractiveMarkerViewer::BodyChangedCallback,
+                        this, OpenRAVE::KinBodyWeakPtr(body)));
         body->SetUserData("interactive_marker", body_marker);
+        BodyChangedCallback(body);
     }
     // Removed.
     else if (flag == 0) {
         body->RemoveUserData("interactive_marker");
+
+        boost::mutex::scoped_lock dirty_lock(dirty_mutex_);
+        dirty_bodies_.erase(body.get());
+    }
+}
+
+void InteractiveMarkerViewer::BodyChangedCallback(
+        OpenRAVE::KinBodyWeakPtr const &weak_body)
+{
+    KinBodyPtr const body = weak_body.lock();
+    if (!body) {
+        return;
     }
+
+    boost::mutex::scoped_lock dirty_lock(dirty_mutex_);
+    dirty_bodies_[body.get()] = weak_body;
 }
 
 void InteractiveMarkerViewer::KinBodyMenuCallback(OpenRAVE::KinBodyPtr kinbody,
@@ -616,10 +1175,95 @@ util::InteractiveMarkerGraphHandlePtr InteractiveMarkerViewer::CreateGraphHandle
         boost::bind(&InteractiveMarkerViewer::GraphHandleRemovedCallback,
                     this, _1)
     );
-    graph_handles_.insert(handle.get());
+    {
+        boost::mutex::scoped_lock graph_lock(graph_handles_mutex_);
+        graph_handles_.insert(handle.get());
+    }
     return handle;
 }
 
+GraphHandlePtr InteractiveMarkerViewer::CreateGraph(
+    InteractiveMarkerPtr const &interactive_marker)
+{
+    if (!graph_batching_) {
+        return CreateGraphHandle(interactive_marker);
+    }
+
+    visualization_msgs::Marker &marker
+        = interactive_marker->controls.front().markers.front();
+
+    // Graphs with per-point colors need one for every point.
+    if (!marker.colors.empty() && marker.colors.size() != marker.points.size()) {
+        return CreateGraphHandle(interactive_marker);
+    }
+
+    // Decide whether to batch before converting the marker, so a graph that
+    // gets its own marker keeps its original type. UpdatePoints relies on it.
+    uint8_t batch_type = marker.type;
+    size_t num_batch_points = marker.points.size();
+    std::vector<geometry_msgs::Point> arrow_points;
+
+    if (marker.type == visualization_msgs::Marker::LINE_STRIP) {
+        batch_type = visualization_msgs::Marker::LINE_LIST;
+        num_batch_points = marker.points.empty() ? 0 : 2 * (marker.points.size() - 1);
+    } else if (marker.type == visualization_msgs::Marker::ARROW
+            && marker.points.size() == 2) {
+        ConvertArrow(marker, &arrow_points);
+        batch_type = visualization_msgs::Marker::TRIANGLE_LIST;
+        num_batch_points = arrow_points.size();
+    } else if (marker.type == visualization_msgs::Marker::CUBE) {
+        batch_type = visualization_msgs::Marker::CUBE_LIST;
+        num_batch_points = 1;
+    }
+
+    if (!GraphBatcher::IsBatchable(batch_type, num_batch_points)
+            || num_batch_points > kMaxBatchedGraphPoints) {
+        return CreateGraphHandle(interactive_marker);
+    }
+
+    // Convert primitives that don't have a list equivalent.
+    if (marker.type == visualization_msgs::Marker::LINE_STRIP) {
+        std::vector<geometry_msgs::Point> segment_points;
+        std::vector<std_msgs::ColorRGBA> segment_colors;
+
+        for (size_t i = 1; i < marker.points.size(); ++i) {
+            segment_points.push_back(marker.points[i - 1]);
+            segment_points.push_back(marker.points[i]);
+
+            if (!marker.colors.empty()) {
+                segment_colors.push_back(marker.colors[i - 1]);
+                segment_colors.push_back(marker.colors[i]);
+            }
+        }
+
+        marker.type = visualization_msgs::Marker::LINE_LIST;
+        marker.points.swap(segment_points);
+        marker.colors.swap(segment_colors);
+    } else if (marker.type == visualization_msgs::Marker::ARROW
+            && marker.points.size() == 2) {
+        marker.type = visualization_msgs::Marker::TRIANGLE_LIST;
+        marker.scale.x = 1.;
+        marker.scale.y = 1.;
+        marker.scale.z = 1.;
+        marker.points.swap(arrow_points);
+        marker.colors.clear();
+    } else if (marker.type == visualization_msgs::Marker::CUBE) {
+        marker.type = visualization_msgs::Marker::CUBE_LIST;
+        marker.points.assign(1, marker.pose.position);
+        marker.pose.position = geometry_msgs::Point();
+    }
+    BOOST_ASSERT(marker.type == batch_type);
+    BOOST_ASSERT(marker.points.size() == num_batch_points);
+
+    if (marker.colors.empty()) {
+        marker.colors.assign(marker.points.size(), marker.color);
+    }
+
+    return graph_batcher_->Add(marker.type, marker.scale,
+                               std::move(marker.points),
+                               std::move(marker.colors));
+}
+
 InteractiveMarkerPtr InteractiveMarkerViewer::CreateMarker() const
 {
     auto interactive_marker = boost::make_shared<InteractiveMarker>();
@@ -646,91 +1290,82 @@ InteractiveMarkerPtr InteractiveMarkerViewer::CreateMarker() const
     return interactive_marker;
 }
 
-void InteractiveMarkerViewer::ConvertPoints(
-        float const *points, int num_points, int stride,
-        std::vector<geometry_msgs::Point> *out_points) const
+void InteractiveMarkerViewer::DecimatePlot(visualization_msgs::Marker *marker)
 {
-    BOOST_ASSERT(points);
-    BOOST_ASSERT(num_points >= 0);
-    BOOST_ASSERT(stride >= 0 && stride % sizeof(float) == 0);
-    BOOST_ASSERT(out_points);
-
-    stride = stride / sizeof(float);
-
-    out_points->resize(num_points);
-    for (size_t ipoint = 0; ipoint < num_points; ++ipoint) {
-        geometry_msgs::Point &out_point = out_points->at(ipoint);
-        out_point.x = points[stride * ipoint + 0];
-        out_point.y = points[stride * ipoint + 1];
-        out_point.z = points[stride * ipoint + 2];
+    BOOST_ASSERT(marker);
+
+    size_t const num_points = marker->points.size();
+    size_t const num_dropped = plot_decimator_.Decimate(&marker->points,
+                                                        &marker->colors);
+    if (num_dropped > 0) {
+        RAVELOG_DEBUG("Decimated plot from %d to %d points.\n",
+                      static_cast<int>(num_points),
+                      static_cast<int>(num_points - num_dropped));
     }
 }
 
-void InteractiveMarkerViewer::ConvertColors(
-        float const *colors, int num_colors, bool has_alpha,
-        std::vector<std_msgs::ColorRGBA> *out_colors) const
+void InteractiveMarkerViewer::ConvertArrow(
+        visualization_msgs::Marker const &arrow,
+        std::vector<geometry_msgs::Point> *out_points) const
 {
-    BOOST_ASSERT(colors);
-    BOOST_ASSERT(num_colors >= 0);
-    BOOST_ASSERT(out_colors);
+    typedef OpenRAVE::RaveVector<double> Vector;
 
-    int stride;
-    if (has_alpha) {
-        stride = 4;
-    } else {
-        stride = 3;
-    }
+    BOOST_ASSERT(arrow.type == visualization_msgs::Marker::ARROW);
+    BOOST_ASSERT(arrow.points.size() == 2);
+    BOOST_ASSERT(out_points);
 
-    out_colors->resize(num_colors);
-    for (size_t icolor = 0; icolor < num_colors; ++icolor) {
-        std_msgs::ColorRGBA &out_color = out_colors->at(icolor);
-        out_color.r = colors[icolor * stride + 0];
-        out_color.g = colors[icolor * stride + 1];
-        out_color.b = colors[icolor * stride + 2];
+    // Same dimensions as RViz's ARROW: scale.x is the shaft diameter,
+    // scale.y is the head diameter, and scale.z is the head length.
+    Vector const start = toORPoint<double>(arrow.points[0]);
+    Vector const end = toORPoint<double>(arrow.points[1]);
+    double const length = std::sqrt((end - start).lengthsqr3());
 
-        if (has_alpha) {
-            out_color.a = colors[icolor * stride + 3];
-        } else {
-            out_color.a = 1.0;
-        }
+    out_points->clear();
+    if (length <= 0.) {
+        return;
     }
-}
-
-void InteractiveMarkerViewer::ConvertMesh(
-        float const *points, int stride, int const *indices, int num_triangles,
-        std::vector<geometry_msgs::Point> *out_points) const
-{
-    BOOST_ASSERT(points);
-    BOOST_ASSERT(stride > 0);
-    BOOST_ASSERT(indices);
-    BOOST_ASSERT(num_triangles >= 0);
-    BOOST_ASSERT(out_points);
 
-    auto const points_raw = reinterpret_cast<uint8_t const *>(points);
-
-    if (num_triangles == 0) {
-        out_points->resize(3);
-        for (int ivertex = 0; ivertex < 3; ++ivertex) {
-            geometry_msgs::Point &point = (*out_points)[ivertex];
-            point.x = 0.;
-            point.y = 0.;
-            point.z = 0.;
-        }
-    } else {
-        out_points->resize(3 * num_triangles);
-        for (int iindex = 0; iindex < num_triangles; ++iindex) {
-            for (int ivertex = 0; ivertex < 3; ++ivertex) {
-                int const index_offset = 3 * iindex + ivertex;
-                float const *or_point = reinterpret_cast<float const *>(
-                    points_raw + stride * indices[index_offset]
-                );
-
-                geometry_msgs::Point &out_point = out_points->at(3 * iindex + ivertex);
-                out_point.x = or_point[0];
-                out_point.y = or_point[1];
-                out_point.z = or_point[2];
-            }
-        }
+    Vector const axis = (end - start) * (1. / length);
+    double const shaft_radius = 0.5 * arrow.scale.x;
+    double const head_radius = 0.5 * arrow.scale.y;
+    double const head_length = std::min<double>(arrow.scale.z, length);
+    Vector const head_base = end - axis * head_length;
+
+    // Orthonormal basis with u x v = axis.
+    Vector const reference = (std::fabs(axis.x) < 0.9)
+        ? Vector(1., 0., 0.) : Vector(0., 1., 0.);
+    Vector u = axis.cross(reference);
+    u.normalize3();
+    Vector const v = axis.cross(u);
+
+    auto const push = [out_points](Vector const &p) {
+        out_points->push_back(toROSPoint(p));
+    };
+
+    out_points->reserve(kArrowSides * 15);
+    for (int iside = 0; iside < kArrowSides; ++iside) {
+        double const theta0 = 2. * M_PI * iside / kArrowSides;
+        double const theta1 = 2. * M_PI * (iside + 1) / kArrowSides;
+        Vector const radial0 = u * std::cos(theta0) + v * std::sin(theta0);
+        Vector const radial1 = u * std::cos(theta1) + v * std::sin(theta1);
+
+        Vector const shaft_bottom0 = start + radial0 * shaft_radius;
+        Vector const shaft_bottom1 = start + radial1 * shaft_radius;
+        Vector const shaft_top0 = head_base + radial0 * shaft_radius;
+        Vector const shaft_top1 = head_base + radial1 * shaft_radius;
+        Vector const head0 = head_base + radial0 * head_radius;
+        Vector const head1 = head_base + radial1 * head_radius;
+
+        // Shaft wall.
+        push(shaft_bottom0); push(shaft_bottom1); push(shaft_top1);
+        push(shaft_bottom0); push(shaft_top1); push(shaft_top0);
+
+        // Shaft cap.
+        push(start); push(shaft_bottom1); push(shaft_bottom0);
+
+        // Head cone and its base.
+        push(head0); push(head1); push(end);
+        push(head_base); push(head1); push(head0);
     }
 }
 
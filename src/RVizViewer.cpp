@@ -39,7 +39,13 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QTimer>
 #include <OgreRenderWindow.h>
 #include <OgreHardwarePixelBuffer.h>
+#include <OgreHighLevelGpuProgramManager.h>
+#include <OgreMaterialManager.h>
+#include <OgreTechnique.h>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/format.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread_time.hpp>
 #include <rviz/display_group.h>
 #include <rviz/render_panel.h>
 #include <rviz/visualization_manager.h>
@@ -54,8 +60,48 @@ using boost::str;
 static double const kRefreshRate = 30;
 static std::string const kOffscreenCameraName = "OffscreenCamera";
 static std::string const kInteractiveMarkersDisplayName = "OpenRAVE Markers";
+static std::string const kMarkerArrayDisplayName = "OpenRAVE Plain Markers";
 static std::string const kEnvironmentDisplayName = "OpenRAVE Environment";
 
+// Number of distinct (width, height, pixel format) render targets to keep
+// around for offscreen rendering. Most users render from a few cameras.
+static size_t const kOffscreenPoolCapacity = 4;
+
+// Maximum number of offscreen render requests waiting for a sync.
+static size_t const kDefaultMaxOffscreenQueueDepth = 16;
+
+// Material scheme used to render metric depth into a float texture. Every
+// material is replaced by a shader that writes the view-space depth.
+static std::string const kDepthSchemeName = "or_rviz/OffscreenDepth";
+static std::string const kDepthMaterialName = "or_rviz/OffscreenDepthMaterial";
+static std::string const kDepthVertexProgramName = "or_rviz/OffscreenDepthVP";
+static std::string const kDepthFragmentProgramName = "or_rviz/OffscreenDepthFP";
+
+static char const * const kDepthVertexProgramSource =
+    "#version 120\n"
+    "uniform mat4 world_view_proj;\n"
+    "uniform mat4 world_view;\n"
+    "varying float depth;\n"
+    "void main() {\n"
+    "    gl_Position = world_view_proj * gl_Vertex;\n"
+    "    depth = -(world_view * gl_Vertex).z;\n"
+    "}\n";
+
+static char const * const kDepthFragmentProgramSource =
+    "#version 120\n"
+    "varying float depth;\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(depth, 0.0, 0.0, 1.0);\n"
+    "}\n";
+
+// Default rate, in Hz, at which frames are captured for image callbacks.
+static double const kDefaultViewerImageRate = 30.;
+
+// Clip distances, in meters, of offscreen views. Views with intrinsics move
+// the near plane to the focal length and keep the same ratio.
+static float const kDefaultNearClip = 0.01f;
+static float const kDefaultFarClip = 100.f;
+
 namespace or_rviz {
 
 /*
@@ -65,11 +111,158 @@ namespace detail {
 
 OffscreenRenderRequest::OffscreenRenderRequest()
     : done(false)
+    , cancelled(false)
     , width(0)
     , height(0)
     , depth(0)
-    , memory(NULL)
+    , with_depth(false)
+{
+}
+
+// Substitutes the depth material for every material when rendering with the
+// depth scheme, so the scene doesn't need depth-specific materials.
+class DepthMaterialListener : public Ogre::MaterialManager::Listener {
+public:
+    explicit DepthMaterialListener(Ogre::Technique *technique)
+        : technique_(technique)
+    {
+        BOOST_ASSERT(technique);
+    }
+
+    virtual Ogre::Technique *handleSchemeNotFound(
+            unsigned short scheme_index, Ogre::String const &scheme_name,
+            Ogre::Material *original_material, unsigned short lod_index,
+            Ogre::Renderable const *renderable)
+    {
+        return technique_;
+    }
+
+private:
+    Ogre::Technique *technique_;
+};
+
+ViewerImage::ViewerImage()
+    : width(0)
+    , height(0)
+    , depth(0)
+{
+}
+
+RenderTargetPool::RenderTargetPool(size_t capacity)
+    : capacity_(capacity)
+    , tick_(0)
+    , hits_(0)
+    , misses_(0)
+    , evictions_(0)
+{
+    BOOST_ASSERT(capacity > 0);
+}
+
+size_t RenderTargetPool::size() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return entries_.size();
+}
+
+size_t RenderTargetPool::capacity() const
+{
+    return capacity_;
+}
+
+size_t RenderTargetPool::hits() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return hits_;
+}
+
+size_t RenderTargetPool::misses() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return misses_;
+}
+
+size_t RenderTargetPool::evictions() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return evictions_;
+}
+
+Ogre::RenderTexture *RenderTargetPool::Acquire(int width, int height,
+                                               Ogre::PixelFormat pixel_format,
+                                               Ogre::Camera *camera)
 {
+    BOOST_ASSERT(camera);
+
+    // Ogre's TextureManager is global, so the name includes the pool to keep
+    // the textures of different viewers apart.
+    std::string const name = str(format("offscreen[%p:%dx%d:%d]")
+        % static_cast<void const *>(this) % width % height
+        % static_cast<int>(pixel_format));
+
+    boost::mutex::scoped_lock lock(mutex_);
+    ++tick_;
+
+    auto const it = entries_.find(name);
+    if (it != entries_.end()) {
+        ++hits_;
+        it->second.last_used = tick_;
+        return it->second.render_texture;
+    }
+    ++misses_;
+
+    // Make room by evicting the least recently used texture.
+    if (entries_.size() >= capacity_) {
+        auto lru_it = entries_.begin();
+        for (auto candidate = entries_.begin(); candidate != entries_.end();
+                ++candidate) {
+            if (candidate->second.last_used < lru_it->second.last_used) {
+                lru_it = candidate;
+            }
+        }
+
+        RAVELOG_DEBUG("Evicting offscreen render target '%s'.\n",
+                      lru_it->first.c_str());
+        Remove(lru_it->first);
+        ++evictions_;
+    }
+
+    Ogre::TexturePtr const texture
+        = Ogre::TextureManager::getSingleton().createManual(
+            name, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
+            Ogre::TEX_TYPE_2D, width, height, 0, pixel_format,
+            Ogre::TU_RENDERTARGET
+    );
+    BOOST_ASSERT(!texture.isNull());
+
+    Ogre::RenderTexture *render_texture
+        = texture->getBuffer()->getRenderTarget();
+    BOOST_ASSERT(render_texture);
+    render_texture->addViewport(camera);
+
+    // Only render when a request asks for it, not on every frame.
+    render_texture->setAutoUpdated(false);
+
+    Entry entry;
+    entry.render_texture = render_texture;
+    entry.last_used = tick_;
+    entries_[name] = entry;
+    return render_texture;
+}
+
+void RenderTargetPool::Clear()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (!entries_.empty()) {
+        Remove(entries_.begin()->first);
+    }
+}
+
+void RenderTargetPool::Remove(std::string const &name)
+{
+    entries_.erase(name);
+    Ogre::TextureManager::getSingleton().unload(name);
+    Ogre::TextureManager::getSingleton().remove(name);
 }
 
 template <typename T>
@@ -132,6 +325,112 @@ T *getOrCreateDisplay(::rviz::VisualizationManager *manager,
 
 }
 
+/*
+ * OffscreenRenderFuture
+ */
+OffscreenRenderFuture::OffscreenRenderFuture()
+{
+}
+
+OffscreenRenderFuture::OffscreenRenderFuture(
+        detail::OffscreenRenderRequestPtr const &request)
+    : request_(request)
+{
+}
+
+bool OffscreenRenderFuture::valid() const
+{
+    return !!request_;
+}
+
+bool OffscreenRenderFuture::is_ready() const
+{
+    BOOST_ASSERT(request_);
+
+    boost::mutex::scoped_lock lock(request_->mutex);
+    return request_->done && !request_->cancelled;
+}
+
+bool OffscreenRenderFuture::is_cancelled() const
+{
+    BOOST_ASSERT(request_);
+
+    boost::mutex::scoped_lock lock(request_->mutex);
+    return request_->cancelled;
+}
+
+bool OffscreenRenderFuture::Wait(double timeout) const
+{
+    BOOST_ASSERT(request_);
+
+    boost::system_time const deadline = boost::get_system_time()
+        + boost::posix_time::microseconds(static_cast<int64_t>(1e6 * timeout));
+
+    boost::mutex::scoped_lock lock(request_->mutex);
+    while (!request_->done && !request_->cancelled) {
+        if (timeout < 0) {
+            request_->condition.wait(lock);
+        } else if (!request_->condition.timed_wait(lock, deadline)) {
+            break;
+        }
+    }
+    return request_->done && !request_->cancelled;
+}
+
+bool OffscreenRenderFuture::Get(std::vector<uint8_t> *memory)
+{
+    BOOST_ASSERT(request_);
+    BOOST_ASSERT(memory);
+
+    boost::mutex::scoped_lock lock(request_->mutex);
+    if (!request_->done || request_->cancelled) {
+        return false;
+    }
+
+    memory->swap(request_->memory);
+    request_->memory.clear();
+    return true;
+}
+
+bool OffscreenRenderFuture::Get(std::vector<uint8_t> *memory,
+                                std::vector<float> *depth)
+{
+    BOOST_ASSERT(request_);
+    BOOST_ASSERT(memory);
+    BOOST_ASSERT(depth);
+
+    boost::mutex::scoped_lock lock(request_->mutex);
+    if (!request_->done || request_->cancelled) {
+        return false;
+    }
+
+    memory->swap(request_->memory);
+    request_->memory.clear();
+    depth->swap(request_->depth_memory);
+    request_->depth_memory.clear();
+    return true;
+}
+
+void OffscreenRenderFuture::Cancel()
+{
+    BOOST_ASSERT(request_);
+
+    {
+        boost::mutex::scoped_lock lock(request_->mutex);
+        request_->cancelled = true;
+        request_->condition.notify_all();
+    }
+
+    // Wake submitters waiting on a full queue, since this request no longer
+    // counts against the limit. Taking the queue lock orders this after any
+    // submitter that has checked the queue but not started waiting yet.
+    detail::OffscreenRenderQueuePtr const queue = request_->queue.lock();
+    if (queue) {
+        boost::mutex::scoped_lock lock(queue->mutex);
+        queue->condition.notify_all();
+    }
+}
+
 /*
  * Public
  */
@@ -139,6 +438,13 @@ RVizViewer::RVizViewer(OpenRAVE::EnvironmentBasePtr env,
                        std::string const &topic_name,
                        bool anonymize)
     : InteractiveMarkerViewer(env, GenerateTopicName(topic_name, anonymize))
+    , offscreen_queue_(boost::make_shared<detail::OffscreenRenderQueue>())
+    , max_offscreen_queue_depth_(kDefaultMaxOffscreenQueueDepth)
+    , offscreen_targets_(kOffscreenPoolCapacity)
+    , viewer_image_write_index_(0)
+    , viewer_image_pending_(false)
+    , viewer_image_stopping_(false)
+    , viewer_image_rate_(kDefaultViewerImageRate)
     , timer_(NULL)
 {
     initialize();
@@ -148,12 +454,58 @@ RVizViewer::RVizViewer(OpenRAVE::EnvironmentBasePtr env,
     rviz_scene_manager_ = rviz_manager_->getSceneManager();
 
     markers_display_ = InitializeInteractiveMarkers();
+    marker_array_display_ = InitializeMarkerArray();
     environment_display_ = InitializeEnvironmentDisplay(env);
     InitializeOffscreenRendering();
     InitializeLighting();
     InitializeMenus();
 
     installEventFilter(this);
+
+    RegisterCommand("GetCameraImages",
+        boost::bind(&RVizViewer::GetCameraImagesCommand, this, _1, _2),
+        "Render several views in one sync. Expects \"width height num_views\""
+        " followed by \"qw qx qy qz tx ty tz fx fy cx cy focal_length\" for"
+        " each view. Outputs the packed 24-bit RGB images."
+    );
+    RegisterCommand("GetRGBDImages",
+        boost::bind(&RVizViewer::GetRGBDImagesCommand, this, _1, _2),
+        "Same as GetCameraImages, but also renders metric depth. Outputs the"
+        " packed 24-bit RGB images followed by the packed float32 depth images."
+    );
+    RegisterCommand("GetOffscreenStats",
+        boost::bind(&RVizViewer::GetOffscreenStatsCommand, this, _1, _2),
+        "Print offscreen render target pool hits, misses, evictions, and size."
+    );
+    RegisterCommand("SetViewerImageRate",
+        boost::bind(&RVizViewer::SetViewerImageRateCommand, this, _1, _2),
+        "Set the maximum rate, in Hz, of viewer image callbacks. Zero captures"
+        " every repaint."
+    );
+    RegisterCommand("SetOffscreenQueueDepth",
+        boost::bind(&RVizViewer::SetOffscreenQueueDepthCommand, this, _1, _2),
+        "Set the maximum number of pending offscreen render requests."
+    );
+}
+
+RVizViewer::~RVizViewer()
+{
+    offscreen_targets_.Clear();
+
+    if (offscreen_depth_listener_) {
+        Ogre::MaterialManager::getSingleton().removeListener(
+            offscreen_depth_listener_.get(), kDepthSchemeName);
+    }
+
+    {
+        boost::mutex::scoped_lock lock(viewer_image_mutex_);
+        viewer_image_stopping_ = true;
+    }
+    viewer_image_condition_.notify_all();
+
+    if (viewer_image_thread_.joinable()) {
+        viewer_image_thread_.join();
+    }
 }
 
 int RVizViewer::main(bool bShow)
@@ -218,9 +570,38 @@ OpenRAVE::UserDataPtr RVizViewer::RegisterViewerImageCallback(
         OpenRAVE::ViewerBase::ViewerImageCallbackFn const &cb)
 {
     boost::signals2::connection const con = viewer_image_callbacks_.connect(cb);
+
+    {
+        boost::mutex::scoped_lock lock(viewer_image_mutex_);
+        if (!viewer_image_thread_.joinable()) {
+            viewer_image_thread_ = boost::thread(
+                boost::bind(&RVizViewer::ViewerImageThread, this));
+        }
+    }
+
     return boost::make_shared<util::ScopedConnection>(con);
 }
 
+double RVizViewer::viewer_image_rate() const
+{
+    boost::mutex::scoped_lock lock(viewer_image_mutex_);
+    return viewer_image_rate_;
+}
+
+void RVizViewer::set_viewer_image_rate(double rate)
+{
+    if (!(rate >= 0)) {
+        throw OpenRAVE::openrave_exception(
+            str(format("Viewer image rate must be non-negative; got %f.")
+                % rate),
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    boost::mutex::scoped_lock lock(viewer_image_mutex_);
+    viewer_image_rate_ = rate;
+}
+
 void RVizViewer::SetCamera(OpenRAVE::RaveTransform<float> &trans,
                            float focalDistance)
 {
@@ -256,123 +637,279 @@ bool RVizViewer::GetCameraImage(
         std::vector<uint8_t> &memory, int width, int height,
         OpenRAVE::RaveTransform<float> const &t,
         OpenRAVE::SensorBase::CameraIntrinsics const &intrinsics)
+{
+    return GetCameraImages(
+        memory, width, height,
+        std::vector<OpenRAVE::RaveTransform<float> >(1, t),
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics>(1, intrinsics)
+    );
+}
+
+bool RVizViewer::GetCameraImages(
+        std::vector<uint8_t> &memory, int width, int height,
+        std::vector<OpenRAVE::RaveTransform<float> > const &extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> const &intrinsics)
+{
+    if (extrinsics.empty()) {
+        memory.clear();
+        return true;
+    }
+
+    OffscreenRenderFuture future = GetCameraImagesAsync(
+        width, height, extrinsics, intrinsics, -1.);
+    BOOST_ASSERT(future.valid());
+
+    // At this point, the output buffer has been populated by the render
+    // thread.
+    future.Wait();
+    return future.Get(&memory);
+}
+
+OffscreenRenderFuture RVizViewer::GetCameraImagesAsync(
+        int width, int height,
+        std::vector<OpenRAVE::RaveTransform<float> > const &extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> const &intrinsics,
+        double queue_timeout)
+{
+    return SubmitOffscreenRenderRequest(width, height, extrinsics, intrinsics,
+                                        false, queue_timeout);
+}
+
+bool RVizViewer::GetRGBDImages(
+        std::vector<uint8_t> &memory, std::vector<float> &depth,
+        int width, int height,
+        std::vector<OpenRAVE::RaveTransform<float> > const &extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> const &intrinsics)
+{
+    if (extrinsics.empty()) {
+        memory.clear();
+        depth.clear();
+        return true;
+    }
+
+    OffscreenRenderFuture future = GetRGBDImagesAsync(
+        width, height, extrinsics, intrinsics, -1.);
+    BOOST_ASSERT(future.valid());
+
+    future.Wait();
+    return future.Get(&memory, &depth);
+}
+
+OffscreenRenderFuture RVizViewer::GetRGBDImagesAsync(
+        int width, int height,
+        std::vector<OpenRAVE::RaveTransform<float> > const &extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> const &intrinsics,
+        double queue_timeout)
+{
+    return SubmitOffscreenRenderRequest(width, height, extrinsics, intrinsics,
+                                        true, queue_timeout);
+}
+
+size_t RVizViewer::max_offscreen_queue_depth() const
+{
+    boost::mutex::scoped_lock lock(offscreen_queue_->mutex);
+    return max_offscreen_queue_depth_;
+}
+
+void RVizViewer::set_max_offscreen_queue_depth(size_t depth)
+{
+    if (depth == 0) {
+        throw OpenRAVE::openrave_exception(
+            "Offscreen queue depth must be positive.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    {
+        boost::mutex::scoped_lock lock(offscreen_queue_->mutex);
+        max_offscreen_queue_depth_ = depth;
+    }
+    offscreen_queue_->condition.notify_all();
+}
+
+OffscreenRenderFuture RVizViewer::SubmitOffscreenRenderRequest(
+        int width, int height,
+        std::vector<OpenRAVE::RaveTransform<float> > const &extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> const &intrinsics,
+        bool with_depth, double queue_timeout)
 {
     static int const depth = 24;
 
     BOOST_ASSERT(width > 0);
     BOOST_ASSERT(height > 0);
     BOOST_ASSERT(depth >= 8 && depth % 8 == 0);
+    BOOST_ASSERT(extrinsics.size() == intrinsics.size());
+
+    size_t const image_size = width * height * (depth / 8);
+
+    auto const request = boost::make_shared<detail::OffscreenRenderRequest>();
+    request->width = width;
+    request->height = height;
+    request->depth = depth;
+    request->with_depth = with_depth;
+    request->memory.resize(extrinsics.size() * image_size, 0x00);
+    if (with_depth) {
+        request->depth_memory.resize(extrinsics.size() * width * height, 0.f);
+    }
+    request->extrinsics = extrinsics;
+    request->intrinsics = intrinsics;
+    request->queue = offscreen_queue_;
 
-    memory.resize(width * height * (depth / 8), 0x00);
-
-    detail::OffscreenRenderRequest request;
-    request.done = false;
-    request.width = width;
-    request.height = height;
-    request.depth = depth;
-    request.memory = &memory.front();
-    request.extrinsics = t;
-    request.intrinsics = intrinsics;
-
-    RAVELOG_DEBUG("Submitting OffscreenRenderRequest(%p).\n", &request);
+    boost::system_time const deadline = boost::get_system_time()
+        + boost::posix_time::microseconds(
+            static_cast<int64_t>(1e6 * queue_timeout));
     {
-        // Make the request.
-        boost::mutex::scoped_lock lock(offscreen_mutex_);
-        offscreen_requests_.push_back(&request);
-
-        // Wait for the request to finish. At this point, the output buffer has
-        // been populated by the render thread.
-        while (!request.done) {
-            offscreen_condition_.wait(lock);
+        boost::mutex::scoped_lock lock(offscreen_queue_->mutex);
+
+        // Apply backpressure by waiting for the render thread to drain the
+        // queue. Cancelled requests don't count against the limit.
+        for (;;) {
+            PruneOffscreenRenderRequests();
+            if (offscreen_requests_.size() < max_offscreen_queue_depth_) {
+                break;
+            }
+
+            if (queue_timeout < 0) {
+                offscreen_queue_->condition.wait(lock);
+            } else if (!offscreen_queue_->condition.timed_wait(lock, deadline)) {
+                RAVELOG_DEBUG("Rejected OffscreenRenderRequest(%p): the queue"
+                              " is full.\n", request.get());
+                return OffscreenRenderFuture();
+            }
         }
+
+        offscreen_requests_.push_back(request);
     }
-    RAVELOG_DEBUG("Completed OffscreenRenderRequest(%p).\n", &request);
+    RAVELOG_DEBUG("Submitted OffscreenRenderRequest(%p).\n", request.get());
 
-    return true;
+    return OffscreenRenderFuture(request);
 }
 
-void RVizViewer::ProcessOffscreenRenderRequests()
+void RVizViewer::ProcessOffscreenRenderRequests(ros::WallTime const &sync_start)
 {
-    while (!offscreen_requests_.empty()) {
-        detail::OffscreenRenderRequest *request;
+    bool is_first = true;
+
+    for (;;) {
+        // Renders run last in the sync, so they get whatever is left of the
+        // budget. Render at least one per sync so callers always progress.
+        if (!is_first && IsOverBudget(sync_start)) {
+            break;
+        }
+
+        detail::OffscreenRenderRequestPtr request;
         {
-            boost::mutex::scoped_lock lock(offscreen_mutex_);
+            boost::mutex::scoped_lock lock(offscreen_queue_->mutex);
+            PruneOffscreenRenderRequests();
+            if (offscreen_requests_.empty()) {
+                break;
+            }
+
             request = offscreen_requests_.front();
             offscreen_requests_.pop_front();
         }
+        offscreen_queue_->condition.notify_all();
+        is_first = false;
 
         RAVELOG_DEBUG(
             "Processing OffscreenRenderRequest(%p): size = [%d x %d],"
-            " depth = %d, focal_length = %f.\n",
-            request, request->width, request->height,
-            request->depth, request->intrinsics.focal_length
+            " depth = %d, views = %d.\n",
+            request.get(), request->width, request->height,
+            request->depth, static_cast<int>(request->extrinsics.size())
         );
 
-        // Setup the camera.
-        //float const &focal_length = request->intrinsics.focal_length;
-        float const focal_length = 0.785;
-        SetCamera(offscreen_camera_, request->extrinsics, focal_length);
-
-#if 0
-        offscreen_camera_->setNearClipDistance(focal_length);
-        offscreen_camera_->setFarClipDistance(focal_length * 10000);
-        offscreen_camera_->setAspectRatio(
-              (request->intrinsics.fy / static_cast<float>(request->height))
-            / (request->intrinsics.fx / static_cast<float>(request->width))
-        );
-        offscreen_camera_->setFOVy(
-            Ogre::Radian(2.0f * std::atan(
-                0.5f * request->height / request->intrinsics.fy))
-        );
-#endif
-
-        // Render the texture into a texture.
-        std::string const name = str(format("offscreen[%p]") % request);
+        // All views in a batch share one render texture. They are rendered
+        // back-to-back so the whole batch finishes in this sync.
         Ogre::PixelFormat const pixel_format = GetPixelFormat(request->depth);
-
-        Ogre::TexturePtr const texture
-            = Ogre::TextureManager::getSingleton().createManual(
-                name, Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME,
-                Ogre::TEX_TYPE_2D, request->width, request->height, 0,
-                pixel_format, Ogre::TU_RENDERTARGET
-        );
-        BOOST_ASSERT(!texture.isNull());
-
-        // Render into the texture.
-        Ogre::RenderTexture *render_texture
-            = texture->getBuffer()->getRenderTarget();
-        BOOST_ASSERT(render_texture);
-        render_texture->addViewport(offscreen_camera_);
-
-        // Copy the texture into the output buffer.
+        Ogre::RenderTexture *render_texture = offscreen_targets_.Acquire(
+            request->width, request->height, pixel_format, offscreen_camera_);
         Ogre::Box const extents(0, 0,  request->width, request->height);
-        Ogre::PixelBox const pb(extents, pixel_format, request->memory);
-        render_texture->update();
-        render_texture->copyContentsToMemory(pb, Ogre::RenderTarget::FB_AUTO);
+        size_t const image_size
+            = request->width * request->height * (request->depth / 8);
+
+        // Depth is rendered into a float texture whose viewport uses the
+        // depth material scheme. It shares the camera with the color pass.
+        Ogre::RenderTexture *depth_texture = NULL;
+        if (request->with_depth) {
+            if (!offscreen_depth_listener_) {
+                InitializeOffscreenDepth();
+            }
+
+            depth_texture = offscreen_targets_.Acquire(
+                request->width, request->height, Ogre::PF_FLOAT32_R,
+                offscreen_camera_);
+
+            Ogre::Viewport *const viewport = depth_texture->getViewport(0);
+            viewport->setMaterialScheme(kDepthSchemeName);
+            viewport->setBackgroundColour(Ogre::ColourValue(0, 0, 0, 0));
+            viewport->setOverlaysEnabled(false);
+            viewport->setSkiesEnabled(false);
+            viewport->setShadowsEnabled(false);
+        }
 
-        // Delete the texture.
-        Ogre::TextureManager::getSingleton().unload(name);
-        Ogre::TextureManager::getSingleton().remove(name);
+        for (size_t iview = 0; iview < request->extrinsics.size(); ++iview) {
+            // Setup the camera.
+            float const focal_length = 0.785;
+            SetCamera(offscreen_camera_, request->extrinsics[iview],
+                      focal_length);
+            SetCameraIntrinsics(offscreen_camera_, request->intrinsics[iview],
+                                request->width, request->height);
+
+            // Copy the texture into this view's slice of the output buffer.
+            // Only this thread touches the buffer until the request is done.
+            Ogre::PixelBox const pb(extents, pixel_format,
+                                    &request->memory[iview * image_size]);
+            render_texture->update();
+            render_texture->copyContentsToMemory(pb, Ogre::RenderTarget::FB_AUTO);
+
+            if (depth_texture) {
+                size_t const depth_offset
+                    = iview * request->width * request->height;
+                Ogre::PixelBox const depth_pb(
+                    extents, Ogre::PF_FLOAT32_R,
+                    &request->depth_memory[depth_offset]);
+                depth_texture->update();
+                depth_texture->copyContentsToMemory(
+                    depth_pb, Ogre::RenderTarget::FB_AUTO);
+            }
+        }
 
         {
-            boost::mutex::scoped_lock lock(offscreen_mutex_);
+            boost::mutex::scoped_lock lock(request->mutex);
             request->done = true;
-            offscreen_condition_.notify_all();
+            request->condition.notify_all();
         }
     }
 }
 
+void RVizViewer::PruneOffscreenRenderRequests()
+{
+    bool is_pruned = false;
+
+    auto it = offscreen_requests_.begin();
+    while (it != offscreen_requests_.end()) {
+        boost::mutex::scoped_lock lock((*it)->mutex);
+
+        if ((*it)->cancelled) {
+            RAVELOG_DEBUG("Dropping cancelled OffscreenRenderRequest(%p).\n",
+                          it->get());
+            it = offscreen_requests_.erase(it);
+            is_pruned = true;
+        } else {
+            ++it;
+        }
+    }
+
+    if (is_pruned) {
+        offscreen_queue_->condition.notify_all();
+    }
+}
+
 bool RVizViewer::eventFilter(QObject *o, QEvent *e)
 {
     bool result = ::rviz::VisualizationFrame::eventFilter(o, e);
 
-    if (e->type() == QEvent::Paint) {
-        if (!viewer_image_callbacks_.empty()) {
-            int width, height, bytes_per_pixel;
-            unsigned char *data = WriteCurrentView(&width, &height,
-                                                   &bytes_per_pixel);
-            viewer_image_callbacks_(data, width, height, bytes_per_pixel);
-        }
+    if (e->type() == QEvent::Paint && !viewer_image_callbacks_.empty()) {
+        CaptureViewerImage();
     }
 
     return result;
@@ -394,11 +931,13 @@ void RVizViewer::LoadEnvironmentSlot()
 void RVizViewer::EnvironmentSyncSlot()
 {
     if (running_) {
+        ros::WallTime const sync_start = ros::WallTime::now();
+
         if(do_sync_) {
             EnvironmentSync();
         }
 
-        ProcessOffscreenRenderRequests();
+        ProcessOffscreenRenderRequests(sync_start);
 
         viewer_callbacks_();
     }
@@ -450,6 +989,55 @@ void RVizViewer::InitializeOffscreenRendering()
     offscreen_camera_ = rviz_scene_manager_->createCamera(kOffscreenCameraName);
 }
 
+void RVizViewer::InitializeOffscreenDepth()
+{
+    BOOST_ASSERT(!offscreen_depth_listener_);
+
+    // RViz always uses the OpenGL render system, so GLSL is available.
+    std::string const &group
+        = Ogre::ResourceGroupManager::DEFAULT_RESOURCE_GROUP_NAME;
+    Ogre::HighLevelGpuProgramManager &programs
+        = Ogre::HighLevelGpuProgramManager::getSingleton();
+
+    Ogre::HighLevelGpuProgramPtr const vertex_program = programs.createProgram(
+        kDepthVertexProgramName, group, "glsl", Ogre::GPT_VERTEX_PROGRAM);
+    vertex_program->setSource(kDepthVertexProgramSource);
+    vertex_program->load();
+
+    Ogre::HighLevelGpuProgramPtr const fragment_program = programs.createProgram(
+        kDepthFragmentProgramName, group, "glsl", Ogre::GPT_FRAGMENT_PROGRAM);
+    fragment_program->setSource(kDepthFragmentProgramSource);
+    fragment_program->load();
+
+    Ogre::MaterialPtr const material
+        = Ogre::MaterialManager::getSingleton().create(kDepthMaterialName, group);
+    Ogre::Pass *const pass = material->getTechnique(0)->getPass(0);
+    pass->setLightingEnabled(false);
+    pass->setVertexProgram(kDepthVertexProgramName);
+    pass->setFragmentProgram(kDepthFragmentProgramName);
+
+    Ogre::GpuProgramParametersSharedPtr const params
+        = pass->getVertexProgramParameters();
+    params->setNamedAutoConstant("world_view_proj",
+        Ogre::GpuProgramParameters::ACT_WORLDVIEWPROJ_MATRIX);
+    params->setNamedAutoConstant("world_view",
+        Ogre::GpuProgramParameters::ACT_WORLDVIEW_MATRIX);
+    material->load();
+
+    Ogre::Technique *const technique = material->getBestTechnique();
+    if (!technique) {
+        throw OpenRAVE::openrave_exception(
+            "Unable to compile the offscreen depth material.",
+            OpenRAVE::ORE_Failed
+        );
+    }
+
+    offscreen_depth_listener_
+        = boost::make_shared<detail::DepthMaterialListener>(technique);
+    Ogre::MaterialManager::getSingleton().addListener(
+        offscreen_depth_listener_.get(), kDepthSchemeName);
+}
+
 void RVizViewer::InitializeMenus()
 {
     menu_openrave_ = new QMenu("OpenRAVE", this);
@@ -471,6 +1059,19 @@ void RVizViewer::InitializeMenus()
     return display;
 }
 
+::rviz::MarkerArrayDisplay *RVizViewer::InitializeMarkerArray()
+{
+    auto *const display =
+        detail::getOrCreateDisplay< ::rviz::MarkerArrayDisplay>(
+            rviz_manager_, "rviz/MarkerArray",
+            kMarkerArrayDisplayName, true);
+
+    display->setTopic(QString::fromStdString(marker_array_topic_name_),
+                      "visualization_msgs/MarkerArray");
+
+    return display;
+}
+
 rviz::EnvironmentDisplay *RVizViewer::InitializeEnvironmentDisplay(
     OpenRAVE::EnvironmentBasePtr const &env)
 {
@@ -495,26 +1096,197 @@ QAction *RVizViewer::LoadEnvironmentAction()
     return toReturn;
 }
 
-unsigned char *RVizViewer::WriteCurrentView(int *width, int *height, int *depth)
+void RVizViewer::CaptureViewerImage()
 {
-    BOOST_ASSERT(width && height && depth);
+    ros::WallTime const now = ros::WallTime::now();
+
+    boost::mutex::scoped_lock lock(viewer_image_mutex_);
+
+    if (viewer_image_rate_ > 0
+            && !viewer_image_last_capture_.isZero()
+            && (now - viewer_image_last_capture_).toSec()
+                < 1. / viewer_image_rate_) {
+        return;
+    }
+    viewer_image_last_capture_ = now;
+
+    // The worker never touches the write buffer, so we can read back into it
+    // even while callbacks are running. If the worker hasn't picked up the
+    // previous frame yet, it is overwritten: slow callbacks drop frames
+    // instead of slowing down the GUI.
+    WriteCurrentView(&viewer_images_[viewer_image_write_index_]);
+    viewer_image_pending_ = true;
+    viewer_image_condition_.notify_one();
+}
+
+void RVizViewer::WriteCurrentView(detail::ViewerImage *image)
+{
+    BOOST_ASSERT(image);
 
     int left, top;
-    render_panel_->getViewport()->getActualDimensions(left, top, *width, *height);
+    render_panel_->getViewport()->getActualDimensions(
+        left, top, image->width, image->height);
 
-    Ogre::PixelFormat format = Ogre::PF_BYTE_RGBA;
-    int outWidth = *width;
-    int outHeight = *height;
-    *depth = Ogre::PixelUtil::getNumElemBytes(format);
+    Ogre::PixelFormat const format = Ogre::PF_BYTE_RGBA;
+    image->depth = Ogre::PixelUtil::getNumElemBytes(format);
+    image->data.resize(image->width * image->height * image->depth);
 
-    unsigned char *data = new unsigned char[outWidth * outHeight * *depth];
-    Ogre::Box extents(left, top, left + *width, top + *height);
-    Ogre::PixelBox pb(extents, format, data);
+    if (image->data.empty()) {
+        return;
+    }
+
+    Ogre::Box const extents(left, top, left + image->width, top + image->height);
+    Ogre::PixelBox const pb(extents, format, &image->data.front());
 
     render_panel_->getRenderWindow()->copyContentsToMemory(
         pb, Ogre::RenderTarget::FB_AUTO);
+}
 
-    return data;
+void RVizViewer::ViewerImageThread()
+{
+    for (;;) {
+        detail::ViewerImage *image;
+        {
+            boost::mutex::scoped_lock lock(viewer_image_mutex_);
+            while (!viewer_image_stopping_ && !viewer_image_pending_) {
+                viewer_image_condition_.wait(lock);
+            }
+            if (viewer_image_stopping_) {
+                return;
+            }
+
+            // Take the newest frame and give the GUI thread the other buffer.
+            image = &viewer_images_[viewer_image_write_index_];
+            viewer_image_write_index_ = 1 - viewer_image_write_index_;
+            viewer_image_pending_ = false;
+        }
+
+        if (!image->data.empty()) {
+            viewer_image_callbacks_(&image->data.front(), image->width,
+                                    image->height, image->depth);
+        }
+    }
+}
+
+bool RVizViewer::GetCameraImagesCommand(std::ostream &out, std::istream &in)
+{
+    int width, height, num_views;
+    in >> width >> height >> num_views;
+
+    if (in.fail() || width <= 0 || height <= 0 || num_views < 0) {
+        throw OpenRAVE::openrave_exception(
+            "GetCameraImages expects a positive width and height followed by"
+            " the number of views.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    std::vector<OpenRAVE::RaveTransform<float> > extrinsics;
+    std::vector<OpenRAVE::SensorBase::CameraIntrinsics> intrinsics;
+    ParseCameraViews(in, num_views, "GetCameraImages", &extrinsics, &intrinsics);
+
+    std::vector<uint8_t> memory;
+    GetCameraImages(memory, width, height, extrinsics, intrinsics);
+    out.write(reinterpret_cast<char const *>(memory.data()), memory.size());
+    return true;
+}
+
+bool RVizViewer::GetRGBDImagesCommand(std::ostream &out, std::istream &in)
+{
+    int width, height, num_views;
+    in >> width >> height >> num_views;
+
+    if (in.fail() || width <= 0 || height <= 0 || num_views < 0) {
+        throw OpenRAVE::openrave_exception(
+            "GetRGBDImages expects a positive width and height followed by"
+            " the number of views.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    std::vector<OpenRAVE::RaveTransform<float> > extrinsics;
+    std::vector<OpenRAVE::SensorBase::CameraIntrinsics> intrinsics;
+    ParseCameraViews(in, num_views, "GetRGBDImages", &extrinsics, &intrinsics);
+
+    std::vector<uint8_t> memory;
+    std::vector<float> depth;
+    GetRGBDImages(memory, depth, width, height, extrinsics, intrinsics);
+    out.write(reinterpret_cast<char const *>(memory.data()), memory.size());
+    out.write(reinterpret_cast<char const *>(depth.data()),
+              depth.size() * sizeof(float));
+    return true;
+}
+
+bool RVizViewer::GetOffscreenStatsCommand(std::ostream &out, std::istream &in)
+{
+    out << offscreen_targets_.hits() << " "
+        << offscreen_targets_.misses() << " "
+        << offscreen_targets_.evictions() << " "
+        << offscreen_targets_.size();
+    return true;
+}
+
+bool RVizViewer::SetOffscreenQueueDepthCommand(std::ostream &out,
+                                               std::istream &in)
+{
+    int depth;
+    in >> depth;
+
+    if (in.fail() || depth <= 0) {
+        throw OpenRAVE::openrave_exception(
+            "SetOffscreenQueueDepth expects a positive integer argument.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    set_max_offscreen_queue_depth(depth);
+    return true;
+}
+
+bool RVizViewer::SetViewerImageRateCommand(std::ostream &out,
+                                           std::istream &in)
+{
+    double rate;
+    in >> rate;
+
+    if (in.fail() || !(rate >= 0)) {
+        throw OpenRAVE::openrave_exception(
+            "SetViewerImageRate expects a non-negative numeric argument.",
+            OpenRAVE::ORE_InvalidArguments
+        );
+    }
+
+    set_viewer_image_rate(rate);
+    return true;
+}
+
+void RVizViewer::ParseCameraViews(
+        std::istream &in, int num_views, std::string const &command,
+        std::vector<OpenRAVE::RaveTransform<float> > *extrinsics,
+        std::vector<OpenRAVE::SensorBase::CameraIntrinsics> *intrinsics) const
+{
+    BOOST_ASSERT(extrinsics && intrinsics);
+
+    extrinsics->resize(num_views);
+    intrinsics->resize(num_views);
+
+    for (int iview = 0; iview < num_views; ++iview) {
+        OpenRAVE::RaveTransform<float> &pose = (*extrinsics)[iview];
+        OpenRAVE::SensorBase::CameraIntrinsics &K = (*intrinsics)[iview];
+
+        in >> pose.rot.x >> pose.rot.y >> pose.rot.z >> pose.rot.w
+           >> pose.trans.x >> pose.trans.y >> pose.trans.z
+           >> K.fx >> K.fy >> K.cx >> K.cy >> K.focal_length;
+
+        if (in.fail()) {
+            throw OpenRAVE::openrave_exception(
+                str(format("%s failed parsing view %d; expected"
+                           " \"qw qx qy qz tx ty tz fx fy cx cy focal_length\".")
+                    % command % iview),
+                OpenRAVE::ORE_InvalidArguments
+            );
+        }
+    }
 }
 
 Ogre::PixelFormat RVizViewer::GetPixelFormat(int depth) const
@@ -548,6 +1320,44 @@ std::string RVizViewer::GenerateTopicName(std::string const &base_name,
     }
 }
 
+void RVizViewer::SetCameraIntrinsics(
+        Ogre::Camera *camera,
+        OpenRAVE::SensorBase::CameraIntrinsics const &intrinsics,
+        int width, int height) const
+{
+    BOOST_ASSERT(camera);
+    BOOST_ASSERT(width > 0 && height > 0);
+
+    // Fall back on Ogre's default projection if no intrinsics are specified.
+    // Reset the clip distances too, since they're left over from the last view.
+    if (!(intrinsics.fx > 0) || !(intrinsics.fy > 0)) {
+        camera->setNearClipDistance(kDefaultNearClip);
+        camera->setFarClipDistance(kDefaultFarClip);
+        camera->setCustomProjectionMatrix(false);
+        return;
+    }
+
+    float const near_clip = (intrinsics.focal_length > 0)
+        ? intrinsics.focal_length : kDefaultNearClip;
+    float const far_clip = near_clip * (kDefaultFarClip / kDefaultNearClip);
+
+    // Pinhole projection with the principal point at (cx, cy), measured in
+    // pixels from the top-left corner of the image. Ogre's camera looks down
+    // the -z axis with +y up, so image rows are flipped.
+    Ogre::Matrix4 projection = Ogre::Matrix4::ZERO;
+    projection[0][0] = 2. * intrinsics.fx / width;
+    projection[0][2] = 1. - 2. * intrinsics.cx / width;
+    projection[1][1] = 2. * intrinsics.fy / height;
+    projection[1][2] = 2. * intrinsics.cy / height - 1.;
+    projection[2][2] = -(far_clip + near_clip) / (far_clip - near_clip);
+    projection[2][3] = -2. * far_clip * near_clip / (far_clip - near_clip);
+    projection[3][2] = -1.;
+
+    camera->setNearClipDistance(near_clip);
+    camera->setFarClipDistance(far_clip);
+    camera->setCustomProjectionMatrix(true, projection);
+}
+
 void RVizViewer::SetCamera(Ogre::Camera *camera,
                            OpenRAVE::RaveTransform<float> const &trans,
                            float focalDistance) const
@@ -0,0 +1,163 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include "util/ros_conversions.h"
+
+using std_msgs::ColorRGBA;
+using or_rviz::util::toROSColors;
+
+// Compares the bulk color conversions in util/ros_conversions against the
+// scalar loop they use when SSE2 is not available. Bandwidth counts the bytes
+// read and written by each conversion; memcpy of a buffer the size of the
+// output is roughly the most we could hope for.
+//
+// Points and mesh points are plain scalar loops: SSE2 versions of them
+// measured within noise of the compiler's own code, so they are not kept.
+//
+// Usage: or_rviz_benchmark_conversions [num_colors]
+
+namespace {
+
+size_t const kDefaultNumColors = 1000000;
+int const kNumTrials = 20;
+
+// Scalar version of the conversion. This matches the fallback path in
+// util/ros_conversions.cpp.
+void ScalarColors(float const *colors, int num_colors, bool has_alpha,
+                  std::vector<ColorRGBA> *out_colors)
+{
+    int const stride = has_alpha ? 4 : 3;
+
+    out_colors->resize(num_colors);
+    for (int icolor = 0; icolor < num_colors; ++icolor) {
+        ColorRGBA &out_color = (*out_colors)[icolor];
+        out_color.r = colors[icolor * stride + 0];
+        out_color.g = colors[icolor * stride + 1];
+        out_color.b = colors[icolor * stride + 2];
+
+        if (has_alpha) {
+            out_color.a = colors[icolor * stride + 3];
+        } else {
+            out_color.a = 1.0;
+        }
+    }
+}
+
+// Best time of several trials, in seconds. The output is written to the same
+// vector every time, so only the first trial pays for allocating it.
+template <class Function>
+double Time(Function const &function)
+{
+    double best = 0;
+
+    for (int itrial = 0; itrial < kNumTrials; ++itrial) {
+        auto const start = std::chrono::steady_clock::now();
+        function();
+        auto const end = std::chrono::steady_clock::now();
+
+        double const elapsed = std::chrono::duration<double>(end - start).count();
+        if (itrial == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+void Report(char const *name, size_t num_bytes, double scalar_time,
+            double simd_time, double memcpy_bandwidth)
+{
+    std::printf("%-18s %9.3f ms %9.3f ms %7.2fx %8.2f GB/s %8.2f GB/s\n",
+        name, 1e3 * scalar_time, 1e3 * simd_time, scalar_time / simd_time,
+        num_bytes / simd_time / 1e9, memcpy_bandwidth / 1e9);
+}
+
+template <class T>
+bool IsEqual(std::vector<T> const &a, std::vector<T> const &b)
+{
+    return a.size() == b.size()
+        && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+// Bandwidth, in bytes per second, of copying a buffer the size of an output.
+// Like the conversions, this reads from one buffer and writes to another.
+double MemcpyBandwidth(size_t num_bytes)
+{
+    std::vector<uint8_t> const in(num_bytes, 1);
+    std::vector<uint8_t> out(num_bytes);
+
+    double const time = Time([&]() {
+        std::memcpy(out.data(), in.data(), num_bytes);
+    });
+    return 2 * num_bytes / time;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    size_t num_colors = kDefaultNumColors;
+    if (argc > 1) {
+        num_colors = std::strtoul(argv[1], NULL, 10);
+    }
+    if (num_colors == 0) {
+        std::fprintf(stderr, "usage: %s [num_colors]\n", argv[0]);
+        return 1;
+    }
+
+#ifdef __SSE2__
+    std::printf("%zu colors, SSE2 enabled\n", num_colors);
+#else
+    std::printf("%zu colors, SSE2 disabled\n", num_colors);
+#endif
+    std::printf("%-18s %12s %12s %8s %13s %13s\n",
+        "conversion", "scalar", "simd", "speedup", "simd", "memcpy");
+
+    // Fixed seed, so every run converts the same data.
+    std::srand(0);
+    std::vector<float> values(4 * num_colors);
+    for (float &value : values) {
+        value = static_cast<float>(std::rand()) / RAND_MAX;
+    }
+
+    int const n = static_cast<int>(num_colors);
+    std::vector<ColorRGBA> scalar_colors, simd_colors;
+    bool is_correct = true;
+
+    size_t const color_bytes = num_colors * sizeof(ColorRGBA);
+    double const color_memcpy = MemcpyBandwidth(color_bytes);
+
+    // RGB colors.
+    {
+        double const scalar_time = Time([&]() {
+            ScalarColors(values.data(), n, false, &scalar_colors);
+        });
+        double const simd_time = Time([&]() {
+            toROSColors(values.data(), n, false, &simd_colors);
+        });
+        is_correct = is_correct && IsEqual(scalar_colors, simd_colors);
+        Report("colors (rgb)", 3 * sizeof(float) * num_colors + color_bytes,
+               scalar_time, simd_time, color_memcpy);
+    }
+
+    // RGBA colors.
+    {
+        double const scalar_time = Time([&]() {
+            ScalarColors(values.data(), n, true, &scalar_colors);
+        });
+        double const simd_time = Time([&]() {
+            toROSColors(values.data(), n, true, &simd_colors);
+        });
+        is_correct = is_correct && IsEqual(scalar_colors, simd_colors);
+        Report("colors (rgba)", 4 * sizeof(float) * num_colors + color_bytes,
+               scalar_time, simd_time, color_memcpy);
+    }
+
+    if (!is_correct) {
+        std::fprintf(stderr, "error: scalar and SIMD results differ\n");
+        return 1;
+    }
+    return 0;
+}
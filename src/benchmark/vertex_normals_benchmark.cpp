@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <boost/thread/thread.hpp>
+#include "util/VertexNormals.h"
+
+using or_rviz::util::ComputeVertexNormals;
+using or_rviz::util::kParallelNormalThreshold;
+
+// Compares util::ComputeVertexNormals against the loop meshToOgre used
+// before it: per triangle, a cross product, three std::acos calls, and six
+// square roots. The mesh is a bumpy height field with about the requested
+// number of triangles.
+//
+// Usage: or_rviz_benchmark_normals [num_triangles]
+
+namespace {
+
+size_t const kDefaultNumTriangles = 500000;
+int const kNumTrials = 5;
+
+void ReferenceNormals(std::vector<float> const &vertices,
+                      std::vector<int> const &indices,
+                      std::vector<float> *normals)
+{
+    normals->assign(vertices.size(), 0.0f);
+
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        float const *v[3];
+        for (int j = 0; j < 3; ++j) {
+            v[j] = &vertices[3 * indices[i + j]];
+        }
+
+        float const e01[3] = { v[1][0] - v[0][0], v[1][1] - v[0][1], v[1][2] - v[0][2] };
+        float const e02[3] = { v[2][0] - v[0][0], v[2][1] - v[0][1], v[2][2] - v[0][2] };
+        float const normal[3] = {
+            e01[1] * e02[2] - e01[2] * e02[1],
+            e01[2] * e02[0] - e01[0] * e02[2],
+            e01[0] * e02[1] - e01[1] * e02[0]
+        };
+
+        for (int j = 0; j < 3; ++j) {
+            float const *p = v[j];
+            float const *q = v[(j + 1) % 3];
+            float const *r = v[(j + 2) % 3];
+            float const a[3] = { q[0] - p[0], q[1] - p[1], q[2] - p[2] };
+            float const b[3] = { r[0] - p[0], r[1] - p[1], r[2] - p[2] };
+            float const length_a = std::sqrt(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+            float const length_b = std::sqrt(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+            float const weight = std::acos(
+                (a[0] * b[0] + a[1] * b[1] + a[2] * b[2]) / (length_a * length_b));
+
+            float *out = &(*normals)[3 * indices[i + j]];
+            out[0] += weight * normal[0];
+            out[1] += weight * normal[1];
+            out[2] += weight * normal[2];
+        }
+    }
+
+    for (size_t i = 0; i < normals->size(); i += 3) {
+        float *normal = &(*normals)[i];
+        float const length = std::sqrt(normal[0] * normal[0]
+            + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length > 1e-08f) {
+            normal[0] /= length;
+            normal[1] /= length;
+            normal[2] /= length;
+        }
+    }
+}
+
+// Square grid of n by n vertices, two triangles per cell.
+void CreateHeightField(size_t n, std::vector<float> *vertices,
+                       std::vector<int> *indices)
+{
+    vertices->clear();
+    indices->clear();
+
+    for (size_t row = 0; row < n; ++row) {
+        for (size_t col = 0; col < n; ++col) {
+            float const x = static_cast<float>(col) / n;
+            float const y = static_cast<float>(row) / n;
+            float const noise = 1e-3f * std::rand() / RAND_MAX;
+            vertices->push_back(x);
+            vertices->push_back(y);
+            vertices->push_back(0.1f * std::sin(20 * x) * std::cos(20 * y) + noise);
+        }
+    }
+
+    for (size_t row = 0; row + 1 < n; ++row) {
+        for (size_t col = 0; col + 1 < n; ++col) {
+            int const i00 = row * n + col;
+            int const i01 = i00 + 1;
+            int const i10 = i00 + n;
+            int const i11 = i10 + 1;
+
+            indices->push_back(i00);
+            indices->push_back(i01);
+            indices->push_back(i11);
+            indices->push_back(i00);
+            indices->push_back(i11);
+            indices->push_back(i10);
+        }
+    }
+}
+
+// Best time of several trials, in seconds.
+template <class Function>
+double Time(Function const &function)
+{
+    double best = 0;
+
+    for (int itrial = 0; itrial < kNumTrials; ++itrial) {
+        auto const start = std::chrono::steady_clock::now();
+        function();
+        auto const end = std::chrono::steady_clock::now();
+
+        double const elapsed = std::chrono::duration<double>(end - start).count();
+        if (itrial == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    size_t num_triangles = kDefaultNumTriangles;
+    if (argc > 1) {
+        num_triangles = std::strtoul(argv[1], NULL, 10);
+    }
+    if (num_triangles == 0) {
+        std::fprintf(stderr, "usage: %s [num_triangles]\n", argv[0]);
+        return 1;
+    }
+
+    // Fixed seed, so every run uses the same mesh.
+    std::srand(0);
+    size_t const n = static_cast<size_t>(std::sqrt(num_triangles / 2.)) + 1;
+    std::vector<float> vertices;
+    std::vector<int> indices;
+    CreateHeightField(n, &vertices, &indices);
+
+    size_t const num_vertices = vertices.size() / 3;
+    num_triangles = indices.size() / 3;
+    unsigned int num_threads = boost::thread::hardware_concurrency();
+    if (num_threads == 0 || num_triangles < kParallelNormalThreshold) {
+        num_threads = 1;
+    }
+
+#ifdef __SSE2__
+    std::printf("%zu triangles, %zu vertices, SSE2 enabled, %u threads\n",
+#else
+    std::printf("%zu triangles, %zu vertices, SSE2 disabled, %u threads\n",
+#endif
+        num_triangles, num_vertices, num_threads);
+
+    std::vector<float> reference_normals;
+    double const reference_time = Time([&]() {
+        ReferenceNormals(vertices, indices, &reference_normals);
+    });
+
+    std::vector<float> normals(vertices.size());
+    double const time = Time([&]() {
+        ComputeVertexNormals(vertices.data(), num_vertices,
+                             indices.data(), num_triangles, normals.data());
+    });
+
+    // Largest angle between the two normals of any vertex.
+    double max_error = 0;
+    for (size_t i = 0; i < normals.size(); i += 3) {
+        double const dot = normals[i] * reference_normals[i]
+            + normals[i + 1] * reference_normals[i + 1]
+            + normals[i + 2] * reference_normals[i + 2];
+        max_error = std::max(max_error, std::acos(std::min(1., dot)));
+    }
+
+    std::printf("reference %9.3f ms\n", 1e3 * reference_time);
+    std::printf("kernel    %9.3f ms  %.2fx\n", 1e3 * time, reference_time / time);
+    std::printf("max error %9.2e rad\n", max_error);
+    return 0;
+}
@@ -141,6 +141,11 @@ double JointMarker::angle() const
     return joint_initial_ + joint_delta_;
 }
 
+bool JointMarker::is_active() const
+{
+    return active_;
+}
+
 void JointMarker::set_parent_frame(std::string const &frame_id)
 {
     marker_.header.frame_id = frame_id;
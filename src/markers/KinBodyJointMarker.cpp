@@ -32,8 +32,6 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "markers/KinBodyJointMarker.h"
 
 using interactive_markers::InteractiveMarkerServer;
-using OpenRAVE::KinBody;
-using OpenRAVE::KinBodyPtr;
 
 typedef boost::shared_ptr<InteractiveMarkerServer> InteractiveMarkerServerPtr;
 typedef OpenRAVE::KinBody::JointPtr JointPtr;
@@ -43,6 +41,7 @@ namespace markers {
 
 KinBodyJointMarker::KinBodyJointMarker(InteractiveMarkerServerPtr server, JointPtr joint)
     : JointMarker(server, joint)
+    , last_value_(angle())
 {
 }
 
@@ -50,23 +49,31 @@ KinBodyJointMarker::~KinBodyJointMarker()
 {
 }
 
+bool KinBodyJointMarker::GetPendingValue(OpenRAVE::dReal *value)
+{
+    BOOST_ASSERT(value);
+    BOOST_ASSERT(joint()->GetDOF() == 1);
+
+    // Start each drag from the value the handle was reset to on the last
+    // sync, so grabbing the handle without moving it writes nothing.
+    OpenRAVE::dReal const angle = this->angle();
+    if (!is_active()) {
+        last_value_ = angle;
+        return false;
+    } else if (angle == last_value_) {
+        return false;
+    }
+
+    *value = angle;
+    last_value_ = angle;
+    return true;
+}
+
 bool KinBodyJointMarker::EnvironmentSync()
 {
-    // Update the KinBody in the OpenRAVE environment.
-    JointPtr const joint = this->joint();
-    KinBodyPtr const kinbody = joint->GetParent();
-    std::vector<int> dof_indices;
-    std::vector<OpenRAVE::dReal> dof_values;
-    dof_indices.push_back(joint->GetJointIndex());
-    kinbody->GetDOFValues(dof_values, dof_indices);
-    BOOST_ASSERT(joint->GetDOF() == 1);
-    BOOST_ASSERT(dof_values.size() == 1);
-
-    dof_values[0] = angle();
-    kinbody->SetDOFValues(dof_values, KinBody::CLA_CheckLimitsSilent, dof_indices);
-
-    // Update the pose of the joint from OpenRAVE.
-    set_pose(GetJointPose(joint));
+    // The KinBody is updated by KinBodyMarker, which batches the writes from
+    // all of its joints. Update the pose of the joint from OpenRAVE.
+    set_pose(GetJointPose(this->joint()));
 
     return JointMarker::EnvironmentSync();
 }
@@ -69,6 +69,11 @@ interactive_markers::MenuHandler &KinBodyLinkMarker::menu_handler()
     return menu_handler_;
 }
 
+void KinBodyLinkMarker::set_changed_callback(boost::function<void ()> const &callback)
+{
+    changed_callback_ = callback;
+}
+
 bool KinBodyLinkMarker::EnvironmentSync()
 {
     bool const is_changed = LinkMarker::EnvironmentSync();
@@ -76,7 +81,8 @@ bool KinBodyLinkMarker::EnvironmentSync()
     OpenRAVE::Transform const link_pose = link()->GetTransform();
     set_pose(link_pose);
 
-    if (is_changed) {
+    // Plain markers don't have a menu.
+    if (is_changed && is_interactive()) {
         UpdateMenu();
     }
 
@@ -186,6 +192,11 @@ void KinBodyLinkMarker::MenuCallback(InteractiveMarkerFeedbackConstPtr const &fe
     // TODO: Should we applyChanges here?
     UpdateMenu();
     server_->applyChanges();
+
+    // Some of these options only take effect on the next EnvironmentSync.
+    if (changed_callback_) {
+        changed_callback_();
+    }
 }
 
 
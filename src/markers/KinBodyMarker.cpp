@@ -34,6 +34,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/range/adaptor/map.hpp>
 #include "markers/KinBodyMarker.h"
+#include "util/TriMeshCache.h"
 #include "util/ros_conversions.h"
 
 using boost::ref;
@@ -65,6 +66,12 @@ typedef MenuHandler::EntryHandle EntryHandle;
 namespace or_rviz {
 namespace markers {
 
+// Seconds that a body stays interactive after it last moved. Plain markers
+// have their pose baked in, so every pose change would republish the meshes
+// of all of the body's links, while an interactive marker only needs a pose
+// update.
+static double const kMotionTimeout = 2.;
+
 // TODO: Move this to a helper header.
 static MenuHandler::CheckState BoolToCheckState(bool const &flag)
 {
@@ -87,12 +94,17 @@ KinBodyMarker::KinBodyMarker(InteractiveMarkerServerPtr server,
     , kinbody_(kinbody)
     , robot_(boost::dynamic_pointer_cast<RobotBase>(kinbody))
     , parent_frame_id_(kDefaultWorldFrameId)
+    , pose_epsilon_(LinkMarker::kDefaultPoseEpsilon)
+    , triangle_budget_(0)
     , has_pose_controls_(false)
     , has_joint_controls_(false)
+    , last_transform_(kinbody->GetTransform())
 {
     BOOST_ASSERT(server);
     BOOST_ASSERT(kinbody);
 
+    kinbody->GetDOFValues(last_dof_values_);
+
     // Create the pose controls.
     interactive_marker_ = boost::make_shared<InteractiveMarker>();
     interactive_marker_->header.frame_id = kDefaultWorldFrameId;
@@ -141,15 +153,25 @@ KinBodyMarker::KinBodyMarker(InteractiveMarkerServerPtr server,
     );
     handle_links_ = kinbody->RegisterChangeCallback(
           OpenRAVE::KinBody::Prop_LinkDraw
-        | OpenRAVE::KinBody::Prop_LinkGeometry
         | OpenRAVE::KinBody::Prop_LinkEnable,
         boost::bind(&KinBodyMarker::InvalidateLinks, this)
     );
+    handle_geometry_ = kinbody->RegisterChangeCallback(
+        OpenRAVE::KinBody::Prop_LinkGeometry,
+        boost::bind(&KinBodyMarker::InvalidateGeometry, this)
+    );
     handle_manipulators_ = kinbody->RegisterChangeCallback(
-          OpenRAVE::KinBody::Prop_RobotManipulatorName
-        | OpenRAVE::KinBody::Prop_RobotManipulatorSolver,
+        OpenRAVE::KinBody::Prop_RobotManipulatorName,
         boost::bind(&KinBodyMarker::InvalidateManipulators, this)
     );
+    handle_manipulator_solvers_ = kinbody->RegisterChangeCallback(
+        OpenRAVE::KinBody::Prop_RobotManipulatorSolver,
+        boost::bind(&KinBodyMarker::InvalidateManipulatorSolvers, this)
+    );
+    handle_transforms_ = kinbody->RegisterChangeCallback(
+        OpenRAVE::KinBody::Prop_LinkTransforms,
+        boost::bind(&KinBodyMarker::Invalidate, this)
+    );
 }
 
 KinBodyMarker::~KinBodyMarker()
@@ -194,6 +216,94 @@ void KinBodyMarker::set_parent_frame(std::string const &frame_id)
     }
 }
 
+void KinBodyMarker::set_pose_epsilon(double epsilon)
+{
+    if (epsilon == pose_epsilon_) {
+        return; // no change
+    }
+
+    pose_epsilon_ = epsilon;
+
+    for (LinkMarkerWrapper const &link_wrapper: link_markers_ | map_values) {
+        link_wrapper.link_marker->set_pose_epsilon(epsilon);
+    }
+
+    for (ManipulatorMarkerPtr const &manip_marker : manipulator_markers_ | map_values) {
+        manip_marker->set_pose_epsilon(epsilon);
+    }
+}
+
+void KinBodyMarker::set_triangle_budget(size_t max_triangles)
+{
+    if (max_triangles == triangle_budget_) {
+        return; // no change
+    }
+
+    triangle_budget_ = max_triangles;
+
+    for (LinkMarkerWrapper const &link_wrapper: link_markers_ | map_values) {
+        link_wrapper.link_marker->set_triangle_budget(max_triangles);
+    }
+
+    for (ManipulatorMarkerPtr const &manip_marker : manipulator_markers_ | map_values) {
+        manip_marker->set_triangle_budget(max_triangles);
+    }
+}
+
+void KinBodyMarker::set_plain_publisher(MarkerArrayPublisherPtr const &publisher)
+{
+    // This takes effect on the next EnvironmentSync.
+    plain_publisher_ = publisher;
+}
+
+void KinBodyMarker::set_dirty_callback(boost::function<void ()> const &callback)
+{
+    dirty_callback_ = callback;
+}
+
+bool KinBodyMarker::is_active() const
+{
+    // Joint handles and ghost manipulators are driven by feedback from RViz,
+    // which does not trigger any OpenRAVE change callbacks.
+    if (has_joint_controls_ || !manipulator_markers_.empty()) {
+        return true;
+    }
+
+    // Keep polling moving bodies, so they return to plain markers once they
+    // stop.
+    if (plain_publisher_ && IsMoving()) {
+        return true;
+    }
+
+    // Keep polling until all background mesh loads finish.
+    for (LinkMarkerWrapper const &wrapper : link_markers_ | map_values) {
+        if (wrapper.link_marker->is_loading()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool KinBodyMarker::has_geometry_changes() const
+{
+    KinBodyPtr const kinbody = kinbody_.lock();
+    if (!kinbody) {
+        return false;
+    }
+
+    // Link markers are created lazily, e.g. after InvalidateLinks.
+    if (link_markers_.size() != kinbody->GetLinks().size()) {
+        return true;
+    }
+
+    for (LinkMarkerWrapper const &wrapper : link_markers_ | map_values) {
+        if (!wrapper.link_marker || wrapper.link_marker->has_geometry_changes()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 std::vector<std::string> KinBodyMarker::group_names() const
 {
     std::set<std::string> all_group_names;
@@ -227,6 +337,7 @@ void KinBodyMarker::AddMenuEntry(std::string const &name,
 
     // TODO: Only re-generate the menu.
     link_markers_.clear();
+    Invalidate();
 }
 
 void KinBodyMarker::AddMenuEntry(LinkPtr link,
@@ -245,6 +356,7 @@ void KinBodyMarker::AddMenuEntry(LinkPtr link,
 
     // TODO: Only re-generate the menu.
     link_markers_.clear();
+    Invalidate();
 }
 
 void KinBodyMarker::AddMenuEntry(ManipulatorPtr manipulator,
@@ -262,6 +374,7 @@ void KinBodyMarker::AddMenuEntry(ManipulatorPtr manipulator,
 
     // TODO: Only re-generate the menu.
     link_markers_.clear();
+    Invalidate();
 }
 
 void KinBodyMarker::EnvironmentSync()
@@ -278,16 +391,29 @@ void KinBodyMarker::EnvironmentSync()
                          interactive_marker_->header);
     }
 
+    // Write the joint handles before updating the links, so the links
+    // reflect them in this sync.
+    ApplyJointControls(kinbody);
+
     // Update links. This includes the geometry of the KinBody.
+    UpdateMotion(kinbody);
+    MarkerArrayPublisherPtr const plain_publisher
+        = IsInteractive() ? MarkerArrayPublisherPtr() : plain_publisher_;
+
     for (LinkPtr link : kinbody->GetLinks()) {
         LinkMarkerWrapper &wrapper = link_markers_[link.get()];
         KinBodyLinkMarkerPtr &link_marker = wrapper.link_marker;
         if (!link_marker) {
             link_marker = boost::make_shared<KinBodyLinkMarker>(server_, link);
             link_marker->set_parent_frame(parent_frame_id_);
+            link_marker->set_pose_epsilon(pose_epsilon_);
+            link_marker->set_triangle_budget(triangle_budget_);
+            link_marker->set_changed_callback(
+                boost::bind(&KinBodyMarker::Invalidate, this));
             CreateMenu(wrapper);
             UpdateMenu(wrapper);
         }
+        link_marker->set_plain_publisher(plain_publisher);
         link_marker->EnvironmentSync();
     }
 
@@ -336,6 +462,34 @@ void KinBodyMarker::EnvironmentSync()
     }
 }
 
+void KinBodyMarker::ApplyJointControls(KinBodyPtr const &kinbody)
+{
+    // Every SetDOFValues call re-computes forward kinematics for the whole
+    // body and fires its change callbacks, so we write all joints at once.
+    std::vector<int> dof_indices;
+    std::vector<OpenRAVE::dReal> dof_values;
+
+    for (KinBodyJointMarkerPtr const &joint_marker : joint_markers_ | map_values) {
+        OpenRAVE::dReal value;
+        if (joint_marker && joint_marker->GetPendingValue(&value)) {
+            dof_indices.push_back(joint_marker->joint()->GetDOFIndex());
+            dof_values.push_back(value);
+        }
+    }
+
+    if (!dof_indices.empty()) {
+        kinbody->SetDOFValues(dof_values, OpenRAVE::KinBody::CLA_CheckLimitsSilent,
+                              dof_indices);
+    }
+}
+
+void KinBodyMarker::Invalidate()
+{
+    if (dirty_callback_) {
+        dirty_callback_();
+    }
+}
+
 void KinBodyMarker::CreateMenu(LinkMarkerWrapper &link_wrapper)
 {
     typedef boost::optional<EntryHandle> Opt;
@@ -551,6 +705,8 @@ void KinBodyMarker::MenuCallback(LinkMarkerWrapper &link_wrapper,
             if (!manipulator_marker) {
                 manipulator_marker = boost::make_shared<ManipulatorMarker>(server_, manipulator);
                 manipulator_marker->set_parent_frame(parent_frame_id_);
+                manipulator_marker->set_pose_epsilon(pose_epsilon_);
+                manipulator_marker->set_triangle_budget(triangle_budget_);
             }
         } else {
             manipulator_markers_.erase(manipulator.get());
@@ -562,6 +718,7 @@ void KinBodyMarker::MenuCallback(LinkMarkerWrapper &link_wrapper,
     }
 
     UpdateMenu();
+    Invalidate();
 }
 
 void KinBodyMarker::EnablePoseControls(bool enabled)
@@ -595,13 +752,66 @@ void KinBodyMarker::InvalidateLinks()
     for (LinkMarkerWrapper const &link_wrapper : link_markers_ | map_values) {
         link_wrapper.link_marker->Invalidate();
     }
+    Invalidate();
+}
+
+void KinBodyMarker::InvalidateGeometry()
+{
+    // SetCollisionMesh changes the mesh in place, so the cached points for
+    // it are stale even though the geometry still exists.
+    if (KinBodyPtr const kinbody = kinbody_.lock()) {
+        TriMeshCache::instance().EvictCollisionMeshes(*kinbody);
+    }
+    InvalidateLinks();
 }
 
 void KinBodyMarker::InvalidateManipulators()
 {
-    // The IK solver may have changed, so we have to completely re-construct
-    // the manipulator markers.
+    // The set of manipulators may have changed, so we have to completely
+    // re-construct the manipulator markers.
     manipulator_markers_.clear();
+    Invalidate();
+}
+
+void KinBodyMarker::InvalidateManipulatorSolvers()
+{
+    // Only the IK solver changed, so the ghost manipulators can stay. They
+    // just have to re-build everything that depends on the solver.
+    for (ManipulatorMarkerPtr const &manipulator_marker : manipulator_markers_ | map_values) {
+        manipulator_marker->InvalidateIkSolver();
+    }
+    Invalidate();
+}
+
+bool KinBodyMarker::IsInteractive() const
+{
+    return !plain_publisher_
+        || has_pose_controls_
+        || has_joint_controls_
+        || !manipulator_markers_.empty()
+        || !menu_custom_kinbody_.empty()
+        || !menu_custom_links_.empty()
+        || !menu_custom_manipulators_.empty()
+        || IsMoving();
+}
+
+bool KinBodyMarker::IsMoving() const
+{
+    return !last_moved_.isZero()
+        && (ros::WallTime::now() - last_moved_).toSec() < kMotionTimeout;
+}
+
+void KinBodyMarker::UpdateMotion(KinBodyPtr const &kinbody)
+{
+    OpenRAVE::Transform const transform = kinbody->GetTransform();
+    std::vector<OpenRAVE::dReal> dof_values;
+    kinbody->GetDOFValues(dof_values);
+
+    if (transform != last_transform_ || dof_values != last_dof_values_) {
+        last_transform_ = transform;
+        last_dof_values_.swap(dof_values);
+        last_moved_ = ros::WallTime::now();
+    }
 }
 
 bool KinBodyMarker::HasGhostManipulator(ManipulatorPtr const manipulator) const
@@ -61,7 +61,6 @@ using interactive_markers::InteractiveMarkerServer;
 using namespace or_rviz::util;
 
 typedef OpenRAVE::KinBody::LinkPtr LinkPtr;
-typedef boost::shared_ptr<OpenRAVE::TriMesh> TriMeshPtr;
 typedef OpenRAVE::RobotBase::ManipulatorPtr ManipulatorPtr;
 typedef OpenRAVE::KinBody::Link::GeometryPtr GeometryPtr;
 typedef boost::shared_ptr<InteractiveMarkerServer> InteractiveMarkerServerPtr;
@@ -70,6 +69,7 @@ namespace or_rviz {
 namespace markers {
 
 OpenRAVE::Vector const LinkMarker::kCollisionColor(0.0, 0.0, 1.0, 0.5);
+double const LinkMarker::kDefaultPoseEpsilon = 1e-6;
 
 LinkMarker::LinkMarker(boost::shared_ptr<InteractiveMarkerServer> server,
                        LinkPtr link, bool is_ghost)
@@ -77,9 +77,12 @@ LinkMarker::LinkMarker(boost::shared_ptr<InteractiveMarkerServer> server,
     , interactive_marker_(boost::make_shared<InteractiveMarker>())
     , view_visual_(true)
     , view_collision_(false)
+    , pose_epsilon_(kDefaultPoseEpsilon)
+    , triangle_budget_(0)
     , link_(link)
     , is_ghost_(is_ghost)
     , force_update_(true)
+    , color_changed_(false)
 {
     BOOST_ASSERT(server);
     BOOST_ASSERT(link);
@@ -105,7 +108,11 @@ LinkMarker::LinkMarker(boost::shared_ptr<InteractiveMarkerServer> server,
 
 LinkMarker::~LinkMarker()
 {
-    server_->erase(interactive_marker_->name);
+    if (plain_publisher_) {
+        plain_publisher_->Erase(interactive_marker_->name);
+    } else {
+        server_->erase(interactive_marker_->name);
+    }
 }
 
 std::string LinkMarker::id() const
@@ -129,25 +136,51 @@ LinkPtr LinkMarker::link() const
     return link_.lock();
 }
 
-void LinkMarker::set_pose(OpenRAVE::Transform const &pose) const
+void LinkMarker::set_pose(OpenRAVE::Transform const &pose)
+{
+    // Most links don't move between updates. Skip them so the server does
+    // not queue (and publish) a pose update for every link.
+    if (!IsPoseChanged(pose)) {
+        return;
+    }
+
+    // Also store the pose in the marker so it is correct if it is re-inserted.
+    interactive_marker_->pose = toROSPose(pose);
+
+    if (plain_publisher_) {
+        PublishPlainMarkers(pose);
+    } else {
+        server_->setPose(interactive_marker_->name, interactive_marker_->pose,
+                         interactive_marker_->header);
+    }
+    published_pose_ = pose;
+}
+
+void LinkMarker::set_pose_epsilon(double epsilon)
+{
+    BOOST_ASSERT(epsilon >= 0.);
+    pose_epsilon_ = epsilon;
+}
+
+void LinkMarker::set_triangle_budget(size_t max_triangles)
 {
-    server_->setPose(interactive_marker_->name, toROSPose(pose),
-                     interactive_marker_->header);
+    force_update_ = force_update_ || (max_triangles != triangle_budget_);
+    triangle_budget_ = max_triangles;
 }
 
 void LinkMarker::clear_color()
 {
-    force_update_ = force_update_ || !!override_color_;
+    color_changed_ = color_changed_ || !!override_color_;
     override_color_.reset();
 }
 
 void LinkMarker::set_color(OpenRAVE::Vector const &color)
 {
-    force_update_ = force_update_ || !override_color_
-                                  || (color[0] != (*override_color_)[0])
-                                  || (color[1] != (*override_color_)[1])
-                                  || (color[2] != (*override_color_)[2])
-                                  || (color[3] != (*override_color_)[3]);
+    color_changed_ = color_changed_ || !override_color_
+                                    || (color[0] != (*override_color_)[0])
+                                    || (color[1] != (*override_color_)[1])
+                                    || (color[2] != (*override_color_)[2])
+                                    || (color[3] != (*override_color_)[3]);
     override_color_.reset(color);
 }
 
@@ -167,6 +200,17 @@ bool LinkMarker::is_view_collision() const
     return view_collision_;
 }
 
+bool LinkMarker::is_loading() const
+{
+    return !pending_meshes_.empty() || !pending_collision_meshes_.empty();
+}
+
+bool LinkMarker::has_geometry_changes() const
+{
+    return force_update_ || color_changed_
+        || (is_loading() && IsLoadFinished());
+}
+
 void LinkMarker::set_view_collision(bool flag)
 {
     force_update_ = force_update_ || (flag != view_collision_);
@@ -193,6 +237,28 @@ void LinkMarker::set_parent_frame(std::string const &frame_id)
     }
 }
 
+void LinkMarker::set_plain_publisher(MarkerArrayPublisherPtr const &publisher)
+{
+    if (publisher == plain_publisher_) {
+        return;
+    }
+
+    // Move the link to the new publisher on the next EnvironmentSync.
+    if (plain_publisher_) {
+        plain_publisher_->Erase(interactive_marker_->name);
+    } else {
+        server_->erase(interactive_marker_->name);
+    }
+
+    plain_publisher_ = publisher;
+    force_update_ = true;
+}
+
+bool LinkMarker::is_interactive() const
+{
+    return !plain_publisher_;
+}
+
 void LinkMarker::SwitchGeometryGroup(std::string const &group)
 {
     link()->SetGeometriesFromGroup(group);
@@ -201,16 +267,34 @@ void LinkMarker::SwitchGeometryGroup(std::string const &group)
 
 bool LinkMarker::EnvironmentSync()
 {
-    LinkPtr const link = this->link();
-    bool is_changed = force_update_;
+    // Swap the placeholders for the real meshes once they finish loading.
+    if (is_loading() && IsLoadFinished()) {
+        force_update_ = true;
+    }
+
+    bool const is_changed = force_update_ || color_changed_;
 
-    // Re-create the geometry.
-    if (is_changed) {
+    // Re-create the geometry. If only the color changed, we can patch the
+    // existing markers instead of loading and converting all of the meshes.
+    if (force_update_) {
         CreateGeometry();
+    } else if (color_changed_) {
+        UpdateColors();
+    }
+
+    // This resets the pose to the one stored in interactive_marker_, so we'll
+    // have to send the next pose update. Plain markers are published with
+    // their pose, so they go out in a single update.
+    if (is_changed && plain_publisher_) {
+        published_pose_.reset();
+        set_pose(link()->GetTransform());
+    } else if (is_changed) {
         server_->insert(*interactive_marker_);
+        published_pose_.reset();
     }
 
     force_update_ = false;
+    color_changed_ = false;
     return is_changed;
 }
 
@@ -222,7 +306,9 @@ void LinkMarker::Invalidate()
 void LinkMarker::CreateGeometry()
 {
     visual_control_->markers.clear();
-    geometry_markers_.clear();
+    marker_sources_.clear();
+    pending_meshes_.clear();
+    pending_collision_meshes_.clear();
 
     LinkPtr const link = this->link();
 
@@ -230,11 +316,6 @@ void LinkMarker::CreateGeometry()
         // Update this geometry's visibility status.
         visibility_map_[geometry.get()] = geometry->IsVisible();
 
-        // Note that this inserts an empty vector if the entry does not already
-        // exist. We depend on this for lazy marker creation.
-        std::vector<visualization_msgs::Marker *> &markers
-                = geometry_markers_[geometry.get()];
-
         if (view_visual_ && geometry->IsVisible()) {
             // Try loading the visual mesh.
             MarkerPtr visual_marker = CreateVisualGeometry(geometry);
@@ -246,34 +327,63 @@ void LinkMarker::CreateGeometry()
             }
 
             if (visual_marker) {
-                visual_control_->markers.push_back(*visual_marker);
-                markers.push_back(&visual_control_->markers.back());
+                AddMarker(geometry, false, visual_marker);
             }
         }
 
         if (view_collision_ && link->IsEnabled()) {
             MarkerPtr const collision_marker = CreateCollisionGeometry(geometry);
 
-            // Make the collision geometry partially transparent if we're also
-            // rendering the collision geometry. It's generally true that the
-            // collision geometry is larger than the visual geometry.
-            if (collision_marker && view_visual_) {
-                collision_marker->color = toROSColor(kCollisionColor);
-                collision_marker->mesh_use_embedded_materials = false;
-            }
-
             if (collision_marker) {
-                visual_control_->markers.push_back(*collision_marker);
-                markers.push_back(&visual_control_->markers.back());
+                AddMarker(geometry, true, collision_marker);
             }
         }
     }
 }
 
-MarkerPtr LinkMarker::CreateVisualGeometry(GeometryPtr geometry)
+void LinkMarker::UpdateColors()
 {
-    MarkerPtr marker = boost::make_shared<Marker>();
-    marker->pose = toROSPose(geometry->GetTransform());
+    BOOST_ASSERT(marker_sources_.size() == visual_control_->markers.size());
+
+    for (size_t imarker = 0; imarker < marker_sources_.size(); ++imarker) {
+        MarkerSource const &source = marker_sources_[imarker];
+        GeometryPtr const geometry = source.geometry.lock();
+
+        // The geometry changed out from under us. This should also trigger a
+        // Prop_LinkGeometry callback, but we may not have received it yet.
+        if (!geometry) {
+            CreateGeometry();
+            return;
+        }
+
+        SetMarkerColor(geometry, source.is_collision,
+                       &visual_control_->markers[imarker]);
+    }
+}
+
+void LinkMarker::AddMarker(GeometryPtr const &geometry, bool is_collision,
+                           MarkerPtr const &marker)
+{
+    SetMarkerColor(geometry, is_collision, marker.get());
+    visual_control_->markers.push_back(*marker);
+
+    MarkerSource source;
+    source.geometry = geometry;
+    source.is_collision = is_collision;
+    marker_sources_.push_back(source);
+}
+
+void LinkMarker::SetMarkerColor(GeometryPtr const &geometry, bool is_collision,
+                                Marker *marker) const
+{
+    // Make the collision geometry partially transparent if we're also
+    // rendering the collision geometry. It's generally true that the
+    // collision geometry is larger than the visual geometry.
+    if (is_collision && view_visual_) {
+        marker->color = toROSColor(kCollisionColor);
+        marker->mesh_use_embedded_materials = false;
+        return;
+    }
 
     if (override_color_) {
         marker->color = toROSColor(*override_color_);
@@ -282,6 +392,25 @@ MarkerPtr LinkMarker::CreateVisualGeometry(GeometryPtr geometry)
         marker->color.a = 1.0 - geometry->GetTransparency();
     }
 
+    if (marker->type == Marker::MESH_RESOURCE) {
+        bool const has_texture = !override_color_ && HasTexture(marker->mesh_resource);
+        marker->mesh_use_embedded_materials = has_texture;
+
+        // Color must be zero to use the embedded material.
+        if (has_texture) {
+            marker->color.r = 0;
+            marker->color.g = 0;
+            marker->color.b = 0;
+            marker->color.a = 0;
+        }
+    }
+}
+
+MarkerPtr LinkMarker::CreateVisualGeometry(GeometryPtr geometry)
+{
+    MarkerPtr marker = boost::make_shared<Marker>();
+    marker->pose = toROSPose(geometry->GetTransform());
+
     // If a render filename is specified, then we should ignore the rest of the
     // geometry. This is true regardless of the mesh type.
     std::string render_mesh_path = geometry->GetRenderFilename();
@@ -295,28 +424,26 @@ MarkerPtr LinkMarker::CreateVisualGeometry(GeometryPtr geometry)
         marker->type = Marker::MESH_RESOURCE;
         marker->scale = toROSVector(geometry->GetRenderScale());
         marker->mesh_resource = "file://" + render_mesh_path;
-
-        bool const has_texture = !override_color_ && HasTexture(render_mesh_path);
-        marker->mesh_use_embedded_materials = has_texture;
-
-        // Color must be zero to use the embedded material.
-        if (has_texture) {
-            marker->color.r = 0;
-            marker->color.g = 0;
-            marker->color.b = 0;
-            marker->color.a = 0;
-        }
         return marker;
     }
     // Otherwise, load the mesh with OpenRAVE and serialize the full mesh it
     // into the marker.
     else if (!render_mesh_path.empty()) {
         OpenRAVE::EnvironmentBasePtr const env = link()->GetParent()->GetEnv();
-        TriMeshPtr trimesh = boost::make_shared<OpenRAVE::TriMesh>();
-        trimesh = env->ReadTrimeshURI(trimesh, render_mesh_path);
-        if (trimesh) {
-            TriMeshToMarker(*trimesh, marker);
-            marker->scale = toROSVector(geometry->GetInfo()._vCollisionScale);
+        OpenRAVE::Vector const &scale = geometry->GetInfo()._vCollisionScale;
+
+        // Parsing large meshes is slow, so we do it on a worker thread and
+        // display the geometry's bounding box until it finishes.
+        bool is_pending;
+        TriMeshCache::PointListConstPtr const points
+            = TriMeshCache::instance().GetRenderMeshAsync(
+                env, render_mesh_path, scale, triangle_budget_, &is_pending);
+        if (is_pending) {
+            pending_meshes_.push_back(std::make_pair(render_mesh_path, scale));
+            return CreatePlaceholderGeometry(geometry);
+        } else if (points) {
+            TriMeshToMarker(points, marker);
+            marker->scale = toROSVector(scale);
 
             static bool already_printed = false;
             if (!already_printed) {
@@ -340,13 +467,6 @@ MarkerPtr LinkMarker::CreateCollisionGeometry(GeometryPtr geometry)
     MarkerPtr marker = boost::make_shared<Marker>();
     marker->pose = toROSPose(geometry->GetTransform());
 
-    if (override_color_) {
-        marker->color = toROSColor(*override_color_);
-    } else {
-        marker->color = toROSColor(geometry->GetDiffuseColor());
-        marker->color.a = 1.0 - geometry->GetTransparency();
-    }
-
     switch (geometry->GetType()) {
     case OpenRAVE::GeometryType::GT_None:
         return MarkerPtr();
@@ -386,9 +506,20 @@ MarkerPtr LinkMarker::CreateCollisionGeometry(GeometryPtr geometry)
         break;
     }
 
-    case OpenRAVE::GeometryType::GT_TriMesh:
-        TriMeshToMarker(geometry->GetCollisionMesh(), marker);
+    case OpenRAVE::GeometryType::GT_TriMesh: {
+        // Simplifying a large mesh to fit the triangle budget is slow, so it
+        // happens in the background, just like loading a render mesh.
+        bool is_pending;
+        TriMeshCache::PointListConstPtr const points
+            = TriMeshCache::instance().GetCollisionMeshAsync(
+                geometry, triangle_budget_, &is_pending);
+        if (is_pending) {
+            pending_collision_meshes_.push_back(geometry);
+            return CreatePlaceholderGeometry(geometry);
+        }
+        TriMeshToMarker(points, marker);
         break;
+    }
 
     default:
         RAVELOG_WARN("Unknown geometry type '%d' for link '%s'.\n",
@@ -399,30 +530,87 @@ MarkerPtr LinkMarker::CreateCollisionGeometry(GeometryPtr geometry)
     return marker;
 }
 
-void LinkMarker::TriMeshToMarker(OpenRAVE::TriMesh const &trimesh,
+MarkerPtr LinkMarker::CreatePlaceholderGeometry(GeometryPtr geometry)
+{
+    // Axis-aligned bounding box in the geometry frame.
+    OpenRAVE::AABB const aabb = geometry->ComputeAABB(OpenRAVE::Transform());
+    if (aabb.extents.x * aabb.extents.y * aabb.extents.z == 0.0) {
+        return MarkerPtr();
+    }
+
+    OpenRAVE::Transform const offset(OpenRAVE::Vector(1, 0, 0, 0), aabb.pos);
+
+    MarkerPtr marker = boost::make_shared<Marker>();
+    marker->type = Marker::CUBE;
+    marker->pose = toROSPose(geometry->GetTransform() * offset);
+    marker->scale = toROSVector(aabb.extents * 2.0);
+    return marker;
+}
+
+bool LinkMarker::IsLoadFinished() const
+{
+    TriMeshCache &cache = TriMeshCache::instance();
+
+    for (auto const &pending_mesh : pending_meshes_) {
+        if (cache.IsRenderMeshPending(pending_mesh.first, pending_mesh.second)) {
+            return false;
+        }
+    }
+
+    // Geometry that was destroyed in the meantime is rebuilt anyway.
+    for (auto const &weak_geometry : pending_collision_meshes_) {
+        GeometryPtr const geometry = weak_geometry.lock();
+        if (geometry && cache.IsCollisionMeshPending(geometry)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void LinkMarker::PublishPlainMarkers(OpenRAVE::Transform const &pose)
+{
+    BOOST_ASSERT(plain_publisher_);
+
+    // Plain markers can't inherit the link's pose, so bake it into each one.
+    // They are locked to the parent frame in case it moves relative to
+    // RViz's fixed frame.
+    std::vector<Marker> markers(visual_control_->markers);
+    for (Marker &marker : markers) {
+        marker.header.frame_id = interactive_marker_->header.frame_id;
+        marker.frame_locked = true;
+        marker.pose = toROSPose(pose * toORPose<OpenRAVE::dReal>(marker.pose));
+    }
+
+    plain_publisher_->Insert(interactive_marker_->name, std::move(markers));
+}
+
+void LinkMarker::TriMeshToMarker(TriMeshCache::PointListConstPtr const &points,
                                  MarkerPtr const &marker)
 {
+    BOOST_ASSERT(points);
+
     marker->type = Marker::TRIANGLE_LIST;
-    marker->points.clear();
-
-    BOOST_ASSERT(trimesh.indices.size() % 3 == 0);
-    for (size_t i = 0; i < trimesh.indices.size() / 3; ++i) {
-        int const index1 = trimesh.indices.at(3 * i + 0);
-        int const index2 = trimesh.indices.at(3 * i + 1);
-        int const index3 = trimesh.indices.at(3 * i + 2);
-        OpenRAVE::Vector const &p1 = trimesh.vertices.at(index1);
-        OpenRAVE::Vector const &p2 = trimesh.vertices.at(index2);
-        OpenRAVE::Vector const &p3 = trimesh.vertices.at(index3);
-        marker->points.push_back(toROSPoint(p1));
-        marker->points.push_back(toROSPoint(p2));
-        marker->points.push_back(toROSPoint(p3));
+    marker->points = *points;
+}
+
+bool LinkMarker::IsPoseChanged(OpenRAVE::Transform const &pose) const
+{
+    if (!published_pose_) {
+        return true;
     }
 
-    if (trimesh.indices.empty())
-    {
-        geometry_msgs::Point const point = toROSPoint(OpenRAVE::Vector());
-        marker->points.resize(3, point);
+    OpenRAVE::Transform const &published_pose = *published_pose_;
+    for (int i = 0; i < 3; ++i) {
+        if (std::fabs(pose.trans[i] - published_pose.trans[i]) > pose_epsilon_) {
+            return true;
+        }
+    }
+    for (int i = 0; i < 4; ++i) {
+        if (std::fabs(pose.rot[i] - published_pose.rot[i]) > pose_epsilon_) {
+            return true;
+        }
     }
+    return false;
 }
 
 bool LinkMarker::HasTexture(std::string const &uri) const
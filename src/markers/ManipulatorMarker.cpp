@@ -71,6 +71,11 @@ namespace markers {
 
 OpenRAVE::Vector const ManipulatorMarker::kValidColor(0, 1, 0, 0.4);
 OpenRAVE::Vector const ManipulatorMarker::kInvalidColor(1, 0, 0, 0.4);
+OpenRAVE::Vector const ManipulatorMarker::kStaleColor(1, 1, 0, 0.4);
+
+// Time, in milliseconds, that the ghost may lag behind the IK target before
+// it is drawn in kStaleColor.
+static long const kStaleTimeoutMs = 500;
 
 ManipulatorMarker::ManipulatorMarker(InteractiveMarkerServerPtr server,
                                      ManipulatorPtr manipulator)
@@ -81,11 +86,16 @@ ManipulatorMarker::ManipulatorMarker(InteractiveMarkerServerPtr server,
     , changed_pose_(true)
     , has_ik_(true)
     , force_update_(false)
+    , has_free_joints_(false)
+    , triangle_budget_(0)
     , current_pose_(manipulator->GetEndEffectorTransform())
 {
     BOOST_ASSERT(server_);
     BOOST_ASSERT(manipulator);
 
+    // Start the ghost at the current configuration of the arm.
+    manipulator->GetRobot()->GetDOFValues(current_ik_, manipulator->GetArmIndices());
+
     // Create the ghost manipulator.
     CreateGeometry();
 
@@ -174,35 +184,86 @@ void ManipulatorMarker::set_parent_frame(std::string const &frame_id)
     }
 }
 
+void ManipulatorMarker::set_pose_epsilon(double epsilon)
+{
+    for (LinkMarkerPtr const &link_marker : link_markers_ | map_values) {
+        link_marker->set_pose_epsilon(epsilon);
+    }
+}
+
+void ManipulatorMarker::set_triangle_budget(size_t max_triangles)
+{
+    triangle_budget_ = max_triangles;
+
+    for (LinkMarkerPtr const &link_marker : link_markers_ | map_values) {
+        link_marker->set_triangle_budget(max_triangles);
+    }
+}
+
+void ManipulatorMarker::InvalidateIkSolver()
+{
+    // Both clones still have the old solver.
+    async_ik_.reset();
+
+    has_free_joints_ = false;
+    free_joints_.clear();
+    free_dof_indices_.clear();
+
+    // The old free joints may not be free in the new solver. They also
+    // belong to the ghost, so they must go before it does.
+    free_joint_markers_.clear();
+    current_free_.clear();
+    ghost_.reset();
+}
+
 bool ManipulatorMarker::EnvironmentSync()
 {
     ManipulatorPtr const manipulator = manipulator_;
     RobotBasePtr const robot = manipulator->GetRobot();
     IkSolverBasePtr const ik_solver = manipulator->GetIkSolver();
-    RobotStateSaver const saver(robot, KinBody::Save_LinkTransformation);
 
     // Hack to avoid crashing if no IK solver is set.
     if (!ik_solver) {
         return false;
     }
 
+    // Pose the ghost using a private copy of the robot. Running FK on the
+    // live robot would fire its change callbacks, e.g. invalidating every
+    // KinBodyMarker, and disturb anyone else holding the environment.
+    if (!ghost_) {
+        ghost_ = boost::make_shared<RobotClone>(robot);
+        ghost_values_.clear();
+    }
+    RobotBasePtr const ghost_robot = ghost_->robot();
+    OpenRAVE::EnvironmentMutex::scoped_lock ghost_lock(ghost_->env()->GetMutex());
+
+    std::vector<OpenRAVE::dReal> dof_values;
+    OpenRAVE::Transform robot_transform;
+    RobotClone::GetState(robot, &dof_values, &robot_transform);
+
     // Figure out what the free joints are.
     size_t const num_free = ik_solver->GetNumFreeParameters();
-    std::vector<JointPtr> free_joints;
-    InferFreeJoints(&free_joints);
-    BOOST_ASSERT(free_joints.size() == num_free);
+    if (!has_free_joints_ || free_joints_.size() != num_free) {
+        InferFreeJoints(&free_joints_);
 
-    std::vector<int> free_dof_indices;
-    for (JointPtr const &free_joint : free_joints) {
-        free_dof_indices.push_back(free_joint->GetJointIndex());
+        free_dof_indices_.clear();
+        for (JointPtr const &free_joint : free_joints_) {
+            free_dof_indices_.push_back(free_joint->GetDOFIndex());
+        }
+        has_free_joints_ = true;
     }
+    BOOST_ASSERT(free_joints_.size() == num_free);
 
-    if (ik_solver) {
-        RobotStateSaver const free_saver(robot, KinBody::Save_LinkTransformation);
+    std::vector<JointPtr> const &free_joints = free_joints_;
+    std::vector<int> const &free_dof_indices = free_dof_indices_;
 
+    if (ik_solver) {
         // Default to the current configuration of the robot.
         if (current_free_.size() != num_free) {
-            robot->GetDOFValues(current_free_, free_dof_indices);
+            current_free_.resize(num_free);
+            for (size_t ifree = 0; ifree < num_free; ++ifree) {
+                current_free_[ifree] = dof_values[free_dof_indices[ifree]];
+            }
         }
 
         // Extract free parameters from the joint controls.
@@ -222,20 +283,34 @@ bool ManipulatorMarker::EnvironmentSync()
             }
         }
 
-        // Set and clamp these joint values to be within limits.
-        robot->SetDOFValues(current_free_, KinBody::CLA_CheckLimitsSilent, free_dof_indices);
-        robot->GetDOFValues(current_free_, free_dof_indices);
-        
-        // Update our IK solution.
+        // Clamp the new joint values to be within limits. This runs FK on
+        // the ghost, so it has to be re-posed below.
+        if (changed_free) {
+            ghost_robot->SetDOFValues(current_free_, KinBody::CLA_CheckLimitsSilent, free_dof_indices);
+            ghost_robot->GetDOFValues(current_free_, free_dof_indices);
+            ghost_values_.clear();
+        }
+
+        if (!async_ik_) {
+            async_ik_ = boost::make_shared<AsyncIkSolver>(manipulator);
+            changed_pose_ = true;
+        }
+
+        // Request a new IK solution. This replaces any request the solver
+        // has not gotten to yet, so it only ever works on the latest pose.
         if (changed_pose_ || changed_free) {
-            std::vector<OpenRAVE::dReal> new_ik;
-            OpenRAVE::IkParameterization ik_param;
-            ik_param.SetTransform6D(current_pose_);
+            std::vector<OpenRAVE::dReal> request_values = dof_values;
+            for (size_t ifree = 0; ifree < num_free; ++ifree) {
+                request_values[free_dof_indices[ifree]] = current_free_[ifree];
+            }
+            async_ik_->Submit(current_pose_, request_values, robot_transform);
+        }
 
-            std::vector<std::vector<OpenRAVE::dReal> > ik_solutions;
-            has_ik_ = manipulator_->FindIKSolution(ik_param, new_ik, 0);
+        AsyncIkSolver::Result result;
+        if (async_ik_->GetResult(&result)) {
+            has_ik_ = result.has_solution;
             if (has_ik_) {
-                current_ik_ = new_ik;
+                current_ik_ = result.solution;
             }
         }
     }
@@ -247,22 +322,49 @@ bool ManipulatorMarker::EnvironmentSync()
         force_update_ = false;
     }
 
-    // Update the pose of the ghost manipulator.
-    auto const dof_indices = manipulator->GetArmIndices();
-    robot->SetDOFValues(current_ik_, 1, dof_indices);
+    // Update the pose of the ghost manipulator: the robot's configuration
+    // with the IK solution on the arm. The solution may still be for the
+    // previous free values, so take those from current_free_ instead. The
+    // free joint controls read their angle back from the ghost and would
+    // otherwise snap back to the old value.
+    std::vector<int> const &arm_indices = manipulator->GetArmIndices();
+    std::vector<OpenRAVE::dReal> ghost_values = dof_values;
+    for (size_t iarm = 0; iarm < arm_indices.size(); ++iarm) {
+        ghost_values[arm_indices[iarm]] = current_ik_[iarm];
+    }
+    for (size_t ifree = 0; ifree < current_free_.size(); ++ifree) {
+        ghost_values[free_dof_indices[ifree]] = current_free_[ifree];
+    }
+
+    // Only run FK when something changed. Most syncs happen while nobody is
+    // touching the robot or the IK handle.
+    if (ghost_values != ghost_values_ || robot_transform != ghost_transform_) {
+        ghost_->SetState(ghost_values, robot_transform);
+        ghost_values_.swap(ghost_values);
+        ghost_transform_ = robot_transform;
+    }
+
+    std::vector<LinkPtr> const &ghost_links = ghost_robot->GetLinks();
+    bool const is_stale = async_ik_
+        && async_ik_->pending_duration() > boost::posix_time::milliseconds(kStaleTimeoutMs);
 
     bool is_changed = false;
     for (LinkMarkerPtr const &link_marker : link_markers_ | map_values) {
         bool const is_link_changed = link_marker->EnvironmentSync();
         if (!is_link_changed) {
-            OpenRAVE::Transform const link_pose = link_marker->link()->GetTransform();
-            link_marker->set_pose(link_pose);
+            LinkPtr const &ghost_link = ghost_links[link_marker->link()->GetIndex()];
+            link_marker->set_pose(ghost_link->GetTransform());
         } else {
             UpdateMenu(link_marker);
         }
 
-        // Set the color to indicate whether we have a valid IK solution.
-        if (has_ik_) {
+        // Set the color to indicate whether the solution on display is
+        // valid. Requests are pending for most of a drag, so only mark the
+        // ghost as stale if the solver falls far behind; every color change
+        // re-sends the links' meshes.
+        if (is_stale) {
+            link_marker->set_color(kStaleColor);
+        } else if (has_ik_) {
             link_marker->set_color(kValidColor);
         } else {
             link_marker->set_color(kInvalidColor);
@@ -277,10 +379,12 @@ bool ManipulatorMarker::EnvironmentSync()
                 continue;
             }
 
-            // Lazily create the marker if it is missing.
+            // Lazily create the marker if it is missing. The free joints
+            // belong to the ghost, so the control follows the ghost arm.
             JointMarkerPtr &joint_marker = free_joint_markers_[joint.get()];
             if (!joint_marker) {
                 joint_marker = boost::make_shared<JointMarker>(server_, joint);
+                joint_marker->set_parent_frame(ik_marker_.header.frame_id);
             }
 
             // Update the pose of the control to match the ghost arm.
@@ -328,7 +432,9 @@ void ManipulatorMarker::CreateGeometry()
 
     // Render each link using a LinkMarker.
     for (LinkPtr const &link : links) {
-        link_markers_[link.get()] = boost::make_shared<LinkMarker>(server_, link, true);
+        LinkMarkerPtr const link_marker = boost::make_shared<LinkMarker>(server_, link, true);
+        link_marker->set_triangle_budget(triangle_budget_);
+        link_markers_[link.get()] = link_marker;
     }
 }
 
@@ -367,6 +473,12 @@ void ManipulatorMarker::MenuCallback(InteractiveMarkerFeedbackConstPtr const &fe
     } else if (feedback->menu_entry_id == menu_reset_) {
         robot->GetDOFValues(current_ik_, arm_indices);
 
+        // Don't let an outstanding request overwrite the snapped solution.
+        if (async_ik_) {
+            async_ik_->Cancel();
+        }
+        has_ik_ = true;
+
         reset_pose_ = true;
         current_pose_ = manipulator_->GetEndEffectorTransform();
         current_free_.clear();
@@ -394,9 +506,13 @@ void ManipulatorMarker::InferFreeJoints(std::vector<JointPtr> *free_joints) cons
 {
     static OpenRAVE::dReal const kEpsilon = 1e-3;
 
-    ManipulatorPtr const manipulator = manipulator_;
-    RobotBasePtr const robot = manipulator->GetRobot();
+    // Run this on the ghost, since it has to move every joint of the arm.
+    BOOST_ASSERT(ghost_);
+    RobotBasePtr const robot = ghost_->robot();
+    ManipulatorPtr const manipulator = robot->GetManipulator(manipulator_->GetName());
+    BOOST_ASSERT(manipulator);
     IkSolverBasePtr const ik_solver = manipulator->GetIkSolver();
+    BOOST_ASSERT(ik_solver);
 
     std::vector<OpenRAVE::dReal> lower_limits, upper_limits;
     robot->GetDOFLimits(lower_limits, upper_limits);
@@ -431,7 +547,7 @@ void ManipulatorMarker::InferFreeJoints(std::vector<JointPtr> *free_joints) cons
         // Calculate the relative change in free parameters.
         for (size_t ifree = 0; ifree < num_free; ++ifree) {
             double const delta_param = upper_free[ifree] - lower_free[ifree];
-            double const delta_value = upper_limits[ifree] - lower_limits[ifree];
+            double const delta_value = upper_limits[dof_index] - lower_limits[dof_index];
             BOOST_ASSERT(delta_value > 0);
             double const ratio = std::fabs(delta_param / delta_value);
 
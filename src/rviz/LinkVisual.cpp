@@ -44,8 +44,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <OgreMaterialManager.h>
 #include <OgreMaterial.h>
 #include <OgreMeshSerializer.h>
+#include <cmath>
+#include <limits>
 #include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
 #include "rviz/Converters.h"
+#include "util/MeshDiskCache.h"
+#include "util/VertexNormals.h"
 #include "rviz/LinkVisual.h"
 #include "rviz/KinBodyVisual.h"
 
@@ -77,7 +83,7 @@ void destroyAllAttachedMovableObjects(Ogre::SceneNode* node)
 
 
 LinkVisual::LinkVisual(KinBodyVisual* kinBody, OpenRAVE::KinBody::LinkPtr link, Ogre::SceneNode* parent, Ogre::SceneManager* sceneManager) :
-        m_kinBody(kinBody), m_link(link), m_parentNode(parent), m_sceneManager(sceneManager)
+        m_kinBody(kinBody), m_link(link), m_parentNode(parent), m_sceneManager(sceneManager), m_weldEpsilon(kDefaultWeldEpsilon)
 {
     m_renderMode = VisualMesh;
     m_sceneNode = m_parentNode->createChildSceneNode();
@@ -93,45 +99,107 @@ void LinkVisual::CreateProperties(rviz::Property *parent)
 {
 }
 
-void DeleteRepeatedVertices(const OpenRAVE::TriMesh& trimesh, std::vector<Ogre::Vector3>& verts, std::vector<int>& indices, bool remove)
+namespace
 {
-    for (size_t i = 0; i < trimesh.indices.size(); i++)
+
+struct WeldCell
+{
+    int64_t x, y, z;
+
+    bool operator==(const WeldCell& other) const
     {
-        indices.push_back(trimesh.indices.at(i));
+        return x == other.x && y == other.y && z == other.z;
     }
+};
 
-    float epsilon = 0.0001;
-    for (size_t i = 0; i < trimesh.vertices.size(); i++)
+struct WeldCellHash
+{
+    size_t operator()(const WeldCell& cell) const
+    {
+        size_t seed = 0;
+        boost::hash_combine(seed, cell.x);
+        boost::hash_combine(seed, cell.y);
+        boost::hash_combine(seed, cell.z);
+        return seed;
+    }
+};
+
+}
+
+const float LinkVisual::kDefaultWeldEpsilon = 0.0001f;
+
+// Merges vertices that are within epsilon of each other along every axis.
+// Vertices are bucketed into a grid with cells of size epsilon, so each
+// vertex only has to be compared against the 27 neighboring cells.
+void DeleteRepeatedVertices(const OpenRAVE::TriMesh& trimesh, std::vector<Ogre::Vector3>& verts, std::vector<int>& indices, bool remove, float epsilon)
+{
+    verts.clear();
+    indices.assign(trimesh.indices.begin(), trimesh.indices.end());
+
+    if (!remove || epsilon <= 0.0f)
     {
-        Ogre::Vector3 vec = converters::ToOgreVector(trimesh.vertices.at(i));
+        verts.reserve(trimesh.vertices.size());
+        for (size_t i = 0; i < trimesh.vertices.size(); i++)
+        {
+            verts.push_back(converters::ToOgreVector(trimesh.vertices[i]));
+        }
+        return;
+    }
 
-        bool copyFound = false;
+    typedef boost::unordered_map<WeldCell, std::vector<int>, WeldCellHash> CellMap;
+    CellMap cells;
+    cells.reserve(trimesh.vertices.size());
 
-        if (remove)
+    std::vector<int> remap(trimesh.vertices.size());
+
+    for (size_t i = 0; i < trimesh.vertices.size(); i++)
+    {
+        Ogre::Vector3 vec = converters::ToOgreVector(trimesh.vertices[i]);
+        WeldCell cell;
+        cell.x = static_cast<int64_t>(std::floor(vec.x / epsilon));
+        cell.y = static_cast<int64_t>(std::floor(vec.y / epsilon));
+        cell.z = static_cast<int64_t>(std::floor(vec.z / epsilon));
+
+        int match = -1;
+        for (int64_t dx = -1; dx <= 1 && match < 0; dx++)
         {
-            for (size_t j = 0; j < verts.size(); j++)
+            for (int64_t dy = -1; dy <= 1 && match < 0; dy++)
             {
-                if (fabs(vec.x - verts[j].x) < epsilon && fabs(vec.y - verts[j].y) < epsilon && fabs(vec.z - verts[j].z) < epsilon)
+                for (int64_t dz = -1; dz <= 1 && match < 0; dz++)
                 {
-                    copyFound = true;
-                    indices[i] = j;
-                    break;
+                    WeldCell neighbor = { cell.x + dx, cell.y + dy, cell.z + dz };
+                    CellMap::const_iterator it = cells.find(neighbor);
+                    if (it == cells.end())
+                    {
+                        continue;
+                    }
+
+                    for (size_t k = 0; k < it->second.size(); k++)
+                    {
+                        const Ogre::Vector3& other = verts[it->second[k]];
+                        if (fabs(vec.x - other.x) < epsilon && fabs(vec.y - other.y) < epsilon && fabs(vec.z - other.z) < epsilon)
+                        {
+                            match = it->second[k];
+                            break;
+                        }
+                    }
                 }
             }
         }
 
-        if (copyFound)
+        if (match < 0)
         {
-            continue;
+            match = static_cast<int>(verts.size());
+            verts.push_back(vec);
+            cells[cell].push_back(match);
         }
+        remap[i] = match;
+    }
 
-        if (remove)
-        {
-            indices[i] = (int) (((verts.size())));
-        }
-        verts.push_back(vec);
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        indices[i] = remap.at(indices[i]);
     }
-    
 }
 
 Ogre::MeshPtr LinkVisual::meshToOgre(const OpenRAVE::TriMesh& trimesh, std::string name)
@@ -146,26 +214,11 @@ Ogre::MeshPtr LinkVisual::meshToOgre(const OpenRAVE::TriMesh& trimesh, std::stri
     Ogre::SubMesh* subMesh = mesh->createSubMesh();
     std::vector < Ogre::Vector3 > verts;
     std::vector<int> index;
-    DeleteRepeatedVertices(trimesh, verts, index, false);
-    std::vector < Ogre::Vector3 > normals(verts.size(), Ogre::Vector3(0, 0, 0));
-    for (std::vector<int>::const_iterator i = index.begin(); i != index.end(); std::advance(i, 3))
+    DeleteRepeatedVertices(trimesh, verts, index, true, m_weldEpsilon);
+    std::vector < Ogre::Vector3 > normals(verts.size());
+    if (!verts.empty())
     {
-        Ogre::Vector3 v[3] =
-        { (verts.at(*i)), (verts.at(*(i + 1))), ((verts.at(*(i + 2)))) };
-
-        Ogre::Vector3 normal = (v[1] - v[0]).crossProduct(v[2] - v[0]);
-        for (int j = 0; j < 3; ++j)
-        {
-            Ogre::Vector3 a = v[(j + 1) % 3] - v[j];
-            Ogre::Vector3 b = v[(j + 2) % 3] - v[j];
-            float weight = acos(a.dotProduct(b) / (a.length() * b.length()));
-            normals[*(i + j)] += weight * normal;
-        }
-    }
-    
-    for (size_t i = 0; i < normals.size(); i++)
-    {
-        normals.at(i).normalise();
+        util::ComputeVertexNormals(verts[0].ptr(), verts.size(), index.empty() ? NULL : &index[0], index.size() / 3, normals[0].ptr());
     }
 
     /* create the vertex data structure */
@@ -210,16 +263,30 @@ Ogre::MeshPtr LinkVisual::meshToOgre(const OpenRAVE::TriMesh& trimesh, std::stri
     /* unlock the buffer */
     vertexBuffer->unlock();
 
-    /* create the index buffer */
-    Ogre::HardwareIndexBufferSharedPtr indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(Ogre::HardwareIndexBuffer::IT_16BIT, trimesh.indices.size(), Ogre::HardwareBuffer::HBU_STATIC);
+    /* create the index buffer, only paying for 32-bit indices when they are
+       needed to address all of the vertices. note that this file is not in
+       any build target (see CMakeLists.txt), so this path is not compiled */
+    bool use32Bit = verts.size() > std::numeric_limits<uint16_t>::max();
+    Ogre::HardwareIndexBuffer::IndexType indexType = use32Bit ? Ogre::HardwareIndexBuffer::IT_32BIT : Ogre::HardwareIndexBuffer::IT_16BIT;
+    Ogre::HardwareIndexBufferSharedPtr indexBuffer = Ogre::HardwareBufferManager::getSingleton().createIndexBuffer(indexType, index.size(), Ogre::HardwareBuffer::HBU_STATIC);
 
     /* lock the buffer so we can get exclusive access to its data */
-    uint16_t* indices = static_cast<uint16_t*>(indexBuffer->lock(Ogre::HardwareBuffer::HBL_NORMAL));
-    i = 0;
-    for (std::vector<int>::const_iterator it = index.begin(); it != index.end(); it++)
+    void* indexData = indexBuffer->lock(Ogre::HardwareBuffer::HBL_NORMAL);
+    if (use32Bit)
     {
-        indices[i] = static_cast<uint16_t>(*it);
-        i++;
+        uint32_t* indices = static_cast<uint32_t*>(indexData);
+        for (size_t j = 0; j < index.size(); j++)
+        {
+            indices[j] = static_cast<uint32_t>(index[j]);
+        }
+    }
+    else
+    {
+        uint16_t* indices = static_cast<uint16_t*>(indexData);
+        for (size_t j = 0; j < index.size(); j++)
+        {
+            indices[j] = static_cast<uint16_t>(index[j]);
+        }
     }
 
     /* unlock the buffer */
@@ -256,7 +323,17 @@ void LinkVisual::LoadRenderMesh(std::string& fileName, OpenRAVE::KinBody::Link::
     if (!mesh.get())
     {
         boost::shared_ptr<OpenRAVE::TriMesh> myMesh = boost::make_shared<OpenRAVE::TriMesh>();
-        m_kinBody->GetKinBody()->GetEnv()->ReadTrimeshFile(myMesh, geom->GetRenderFilename());
+        util::MeshDiskCache const& diskCache = util::MeshDiskCache::instance();
+
+        if (!diskCache.Load(geom->GetRenderFilename(), geom->GetRenderScale(), myMesh.get()))
+        {
+            m_kinBody->GetKinBody()->GetEnv()->ReadTrimeshFile(myMesh, geom->GetRenderFilename());
+
+            if (myMesh->vertices.size() >= 3)
+            {
+                diskCache.Store(geom->GetRenderFilename(), geom->GetRenderScale(), *myMesh);
+            }
+        }
 
         try {
             if (myMesh->vertices.size() >= 3) {
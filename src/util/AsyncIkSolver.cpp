@@ -0,0 +1,138 @@
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include "util/AsyncIkSolver.h"
+
+namespace or_rviz {
+namespace util {
+
+AsyncIkSolver::AsyncIkSolver(
+        OpenRAVE::RobotBase::ManipulatorPtr const &manipulator)
+    : clone_(boost::make_shared<RobotClone>(manipulator->GetRobot()))
+    , manipulator_(clone_->robot()->GetManipulator(manipulator->GetName()))
+    , stopping_(false)
+    , latest_id_(0)
+    , solved_id_(0)
+    , cancelled_id_(0)
+{
+    BOOST_ASSERT(manipulator_);
+
+    thread_ = boost::thread(boost::bind(&AsyncIkSolver::WorkerThread, this));
+}
+
+AsyncIkSolver::~AsyncIkSolver()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopping_ = true;
+        request_.reset();
+    }
+    condition_.notify_all();
+
+    // This waits for an in-progress solve, which we have no way to cancel.
+    thread_.join();
+}
+
+bool AsyncIkSolver::is_pending() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return solved_id_ != latest_id_;
+}
+
+boost::posix_time::time_duration AsyncIkSolver::pending_duration() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    if (solved_id_ == latest_id_) {
+        return boost::posix_time::time_duration();
+    }
+    return boost::get_system_time() - stale_since_;
+}
+
+void AsyncIkSolver::Submit(OpenRAVE::Transform const &pose,
+                           std::vector<OpenRAVE::dReal> const &dof_values,
+                           OpenRAVE::Transform const &robot_transform)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (solved_id_ == latest_id_) {
+            stale_since_ = boost::get_system_time();
+        }
+
+        Request request;
+        request.id = ++latest_id_;
+        request.pose = pose;
+        request.dof_values = dof_values;
+        request.robot_transform = robot_transform;
+        request_ = request;
+    }
+    condition_.notify_one();
+}
+
+void AsyncIkSolver::Cancel()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    request_.reset();
+
+    // Also discard the result of a request that is being solved.
+    ++latest_id_;
+    solved_id_ = latest_id_;
+    cancelled_id_ = latest_id_;
+}
+
+bool AsyncIkSolver::GetResult(Result *result)
+{
+    BOOST_ASSERT(result);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (!result_) {
+        return false;
+    }
+
+    *result = *result_;
+    result_.reset();
+    return true;
+}
+
+void AsyncIkSolver::WorkerThread()
+{
+    for (;;) {
+        Request request;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            while (!stopping_ && !request_) {
+                condition_.wait(lock);
+            }
+            if (stopping_) {
+                return;
+            }
+
+            request = *request_;
+            request_.reset();
+        }
+
+        Result result;
+        {
+            OpenRAVE::EnvironmentMutex::scoped_lock env_lock(
+                clone_->env()->GetMutex());
+            clone_->SetState(request.dof_values, request.robot_transform);
+
+            OpenRAVE::IkParameterization ik_param;
+            ik_param.SetTransform6D(request.pose);
+            result.has_solution = manipulator_->FindIKSolution(
+                ik_param, result.solution, 0);
+        }
+
+        // Publish the result even if a newer request is waiting; it is still
+        // newer than the one on display. Requests are solved in order, so
+        // only a Cancel can make it obsolete.
+        boost::mutex::scoped_lock lock(mutex_);
+        if (request.id > cancelled_id_) {
+            result_ = result;
+            solved_id_ = request.id;
+            stale_since_ = boost::get_system_time();
+        }
+    }
+}
+
+}
+}
@@ -0,0 +1,304 @@
+#include <algorithm>
+#include <boost/format.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/range/adaptor/map.hpp>
+#include <visualization_msgs/InteractiveMarker.h>
+#include "util/ros_conversions.h"
+#include "util/GraphBatcher.h"
+
+using boost::format;
+using boost::str;
+using geometry_msgs::Point;
+using std_msgs::ColorRGBA;
+
+namespace or_rviz {
+namespace util {
+
+// Every change to a slice re-sends its whole batch, so batches are kept
+// small enough that this stays cheap.
+size_t const GraphBatcher::kMaxBatchPoints = 16384;
+
+class GraphBatcher::Handle : public OpenRAVE::GraphHandle {
+public:
+    Handle(boost::weak_ptr<GraphBatcher> const &batcher, size_t slice_id)
+        : batcher_(batcher)
+        , slice_id_(slice_id)
+    {
+    }
+
+    virtual ~Handle()
+    {
+        if (GraphBatcherPtr const batcher = batcher_.lock()) {
+            batcher->Remove(slice_id_);
+        }
+    }
+
+    virtual void SetTransform(OpenRAVE::RaveTransform<float> const &t)
+    {
+        if (GraphBatcherPtr const batcher = batcher_.lock()) {
+            batcher->SetTransform(slice_id_, t);
+        }
+    }
+
+    virtual void SetShow(bool show)
+    {
+        if (GraphBatcherPtr const batcher = batcher_.lock()) {
+            batcher->SetShow(slice_id_, show);
+        }
+    }
+
+private:
+    boost::weak_ptr<GraphBatcher> batcher_;
+    size_t slice_id_;
+};
+
+GraphBatcher::BatchKey::BatchKey(uint8_t type,
+                                 geometry_msgs::Vector3 const &scale)
+    : type(type)
+{
+    this->scale[0] = scale.x;
+    this->scale[1] = scale.y;
+    this->scale[2] = scale.z;
+}
+
+bool GraphBatcher::BatchKey::operator<(BatchKey const &other) const
+{
+    if (type != other.type) {
+        return type < other.type;
+    }
+    return std::lexicographical_compare(scale, scale + 3,
+                                        other.scale, other.scale + 3);
+}
+
+GraphBatcher::Batch::Batch(BatchKey const &key)
+    : key(key)
+    , num_points(0)
+    , is_dirty(false)
+    , is_published(false)
+{
+    name = str(format("GraphBatch[%p]") % this);
+}
+
+GraphBatcher::GraphBatcher(InteractiveMarkerServerPtr const &server)
+    : server_(server)
+    , frame_id_(kDefaultWorldFrameId)
+    , next_slice_id_(0)
+{
+    BOOST_ASSERT(server);
+}
+
+GraphBatcher::~GraphBatcher()
+{
+    for (std::vector<BatchPtr> const &batches : batches_ | boost::adaptors::map_values) {
+        for (BatchPtr const &batch : batches) {
+            if (batch->is_published) {
+                server_->erase(batch->name);
+            }
+        }
+    }
+}
+
+void GraphBatcher::set_parent_frame(std::string const &frame_id)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (frame_id == frame_id_) {
+        return;
+    }
+    frame_id_ = frame_id;
+
+    for (std::vector<BatchPtr> const &batches : batches_ | boost::adaptors::map_values) {
+        for (BatchPtr const &batch : batches) {
+            batch->is_dirty = true;
+        }
+    }
+}
+
+bool GraphBatcher::IsBatchable(uint8_t type, size_t num_points)
+{
+    // Lines and triangles are made from consecutive points, so a partial one
+    // would shift every slice after it in the batch.
+    if (type == visualization_msgs::Marker::LINE_LIST) {
+        return num_points % 2 == 0;
+    } else if (type == visualization_msgs::Marker::TRIANGLE_LIST) {
+        return num_points % 3 == 0;
+    }
+
+    return type == visualization_msgs::Marker::POINTS
+        || type == visualization_msgs::Marker::SPHERE_LIST
+        || type == visualization_msgs::Marker::CUBE_LIST;
+}
+
+OpenRAVE::GraphHandlePtr GraphBatcher::Add(
+        uint8_t type, geometry_msgs::Vector3 const &scale,
+        std::vector<Point> points, std::vector<ColorRGBA> colors)
+{
+    BOOST_ASSERT(IsBatchable(type, points.size()));
+    BOOST_ASSERT(colors.size() == points.size());
+
+    size_t slice_id;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        slice_id = next_slice_id_++;
+        Slice &slice = slices_[slice_id];
+        slice.batch = FindBatch(BatchKey(type, scale), points.size());
+        slice.points.swap(points);
+        slice.colors.swap(colors);
+        slice.show = true;
+
+        slice.batch->slice_ids.insert(slice_id);
+        slice.batch->num_points += slice.points.size();
+        slice.batch->is_dirty = true;
+    }
+
+    return boost::make_shared<Handle>(shared_from_this(), slice_id);
+}
+
+void GraphBatcher::Flush()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (auto it = batches_.begin(); it != batches_.end(); ) {
+        std::vector<BatchPtr> &batches = it->second;
+
+        for (size_t ibatch = 0; ibatch < batches.size(); ) {
+            Batch *const batch = batches[ibatch].get();
+            if (batch->is_dirty) {
+                PublishBatch(batch);
+                batch->is_dirty = false;
+            }
+
+            // Drop batches once their last slice is removed.
+            if (batch->slice_ids.empty()) {
+                batches.erase(batches.begin() + ibatch);
+            } else {
+                ++ibatch;
+            }
+        }
+
+        if (batches.empty()) {
+            it = batches_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void GraphBatcher::Remove(size_t slice_id)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    auto const it = slices_.find(slice_id);
+    BOOST_ASSERT(it != slices_.end());
+
+    Batch &batch = *it->second.batch;
+    batch.slice_ids.erase(slice_id);
+    batch.num_points -= it->second.points.size();
+    batch.is_dirty = true;
+
+    slices_.erase(it);
+}
+
+void GraphBatcher::SetShow(size_t slice_id, bool show)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Slice &slice = slices_.at(slice_id);
+    if (show != slice.show) {
+        slice.show = show;
+        slice.batch->is_dirty = true;
+    }
+}
+
+void GraphBatcher::SetTransform(size_t slice_id,
+                                OpenRAVE::RaveTransform<float> const &t)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Slice &slice = slices_.at(slice_id);
+    slice.transform = t;
+    slice.batch->is_dirty = true;
+}
+
+GraphBatcher::BatchPtr GraphBatcher::FindBatch(BatchKey const &key,
+                                               size_t num_points)
+{
+    std::vector<BatchPtr> &batches = batches_[key];
+
+    for (BatchPtr const &batch : batches) {
+        if (batch->num_points + num_points <= kMaxBatchPoints) {
+            return batch;
+        }
+    }
+
+    auto const batch = boost::make_shared<Batch>(key);
+    batches.push_back(batch);
+    return batch;
+}
+
+void GraphBatcher::PublishBatch(Batch *batch)
+{
+    BOOST_ASSERT(batch);
+
+    visualization_msgs::InteractiveMarker interactive_marker;
+    interactive_marker.header.frame_id = frame_id_;
+    interactive_marker.pose = toROSPose(OpenRAVE::Transform());
+    interactive_marker.name = batch->name;
+    interactive_marker.scale = 1.0;
+
+    interactive_marker.controls.resize(1);
+    visualization_msgs::InteractiveMarkerControl &control
+        = interactive_marker.controls.front();
+    control.orientation_mode = visualization_msgs::InteractiveMarkerControl::INHERIT;
+    control.interaction_mode = visualization_msgs::InteractiveMarkerControl::NONE;
+    control.always_visible = true;
+
+    control.markers.resize(1);
+    visualization_msgs::Marker &marker = control.markers.front();
+    marker.action = visualization_msgs::Marker::ADD;
+    marker.type = batch->key.type;
+    marker.pose.orientation.w = 1.0;
+    marker.scale.x = batch->key.scale[0];
+    marker.scale.y = batch->key.scale[1];
+    marker.scale.z = batch->key.scale[2];
+    marker.color.r = 1.0;
+    marker.color.g = 1.0;
+    marker.color.b = 1.0;
+    marker.color.a = 1.0;
+    marker.points.reserve(batch->num_points);
+    marker.colors.reserve(batch->num_points);
+
+    OpenRAVE::RaveTransform<float> const identity;
+
+    for (size_t const slice_id : batch->slice_ids) {
+        Slice const &slice = slices_.at(slice_id);
+        if (!slice.show) {
+            continue;
+        }
+
+        if (slice.transform.rot == identity.rot
+                && slice.transform.trans == identity.trans) {
+            marker.points.insert(marker.points.end(),
+                                 slice.points.begin(), slice.points.end());
+        } else {
+            for (Point const &point : slice.points) {
+                marker.points.push_back(toROSPoint(
+                    slice.transform * toORPoint<float>(point)));
+            }
+        }
+        marker.colors.insert(marker.colors.end(),
+                             slice.colors.begin(), slice.colors.end());
+    }
+
+    if (!marker.points.empty()) {
+        server_->insert(interactive_marker);
+        batch->is_published = true;
+    } else if (batch->is_published) {
+        server_->erase(batch->name);
+        batch->is_published = false;
+    }
+}
+
+}
+}
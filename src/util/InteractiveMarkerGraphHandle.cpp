@@ -14,9 +14,12 @@ InteractiveMarkerGraphHandle::InteractiveMarkerGraphHandle(
     , interactive_marker_(interactive_marker)
     , remove_callback_(callback)
     , show_(true)
+    , is_dirty_(false)
 {
     BOOST_ASSERT(interactive_marker_server);
     BOOST_ASSERT(interactive_marker);
+    BOOST_ASSERT(interactive_marker->controls.size() == 1);
+    BOOST_ASSERT(interactive_marker->controls.front().markers.size() == 1);
 
     server_->insert(*interactive_marker_);
 }
@@ -31,32 +34,113 @@ InteractiveMarkerGraphHandle::~InteractiveMarkerGraphHandle()
 
 void InteractiveMarkerGraphHandle::set_parent_frame(std::string const &frame_id)
 {
-    bool const is_changed = (frame_id != interactive_marker_->header.frame_id);
-    interactive_marker_->header.frame_id = frame_id;
+    boost::mutex::scoped_lock lock(mutex_);
 
-    if (show_ && is_changed) {
-        server_->insert(*interactive_marker_);
+    if (frame_id != interactive_marker_->header.frame_id) {
+        interactive_marker_->header.frame_id = frame_id;
+        is_dirty_ = true;
     }
 }
 
 void InteractiveMarkerGraphHandle::SetTransform(
     OpenRAVE::RaveTransform<float> const &t)
 {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    interactive_marker_->pose = toROSPose<>(t);
+
     if (show_) {
-        server_->setPose(interactive_marker_->name, toROSPose<>(t),
+        server_->setPose(interactive_marker_->name, interactive_marker_->pose,
                          interactive_marker_->header);
     }
 }
 
 void InteractiveMarkerGraphHandle::SetShow(bool show)
 {
+    boost::mutex::scoped_lock lock(mutex_);
+
     if (show && !show_) {
         server_->insert(*interactive_marker_);
+        is_dirty_ = false;
     } else if (!show && show_) {
         server_->erase(interactive_marker_->name);
     }
     show_ = show;
 }
 
+void InteractiveMarkerGraphHandle::UpdatePoints(
+        std::vector<geometry_msgs::Point> points)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    marker().points.swap(points);
+    is_dirty_ = true;
+}
+
+void InteractiveMarkerGraphHandle::UpdatePoints(
+        float const *points, int num_points, int stride)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // Convert in place to re-use the existing allocation.
+    toROSPoints(points, num_points, stride, &marker().points);
+    is_dirty_ = true;
+}
+
+void InteractiveMarkerGraphHandle::UpdateColors(
+        std::vector<std_msgs::ColorRGBA> colors)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    marker().colors.swap(colors);
+    is_dirty_ = true;
+}
+
+void InteractiveMarkerGraphHandle::UpdateColors(
+        float const *colors, int num_colors, bool has_alpha)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    toROSColors(colors, num_colors, has_alpha, &marker().colors);
+    is_dirty_ = true;
+}
+
+void InteractiveMarkerGraphHandle::UpdateColor(
+        OpenRAVE::RaveVector<float> const &color)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    marker().color = toROSColor<>(color);
+    marker().colors.clear();
+    is_dirty_ = true;
+}
+
+void InteractiveMarkerGraphHandle::Flush()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // Hidden graphs are published when they are shown again.
+    if (!is_dirty_ || !show_) {
+        return;
+    }
+
+    visualization_msgs::Marker const &marker = this->marker();
+    if (!marker.colors.empty() && marker.colors.size() != marker.points.size()) {
+        RAVELOG_WARN("Not updating graph '%s': it has %d points, but %d"
+                     " colors.\n", interactive_marker_->name.c_str(),
+                     static_cast<int>(marker.points.size()),
+                     static_cast<int>(marker.colors.size()));
+        return;
+    }
+
+    server_->insert(*interactive_marker_);
+    is_dirty_ = false;
+}
+
+visualization_msgs::Marker &InteractiveMarkerGraphHandle::marker()
+{
+    return interactive_marker_->controls.front().markers.front();
+}
+
 }
 }
@@ -0,0 +1,116 @@
+#include <boost/bind.hpp>
+#include <boost/range/adaptor/map.hpp>
+#include "util/MarkerArrayPublisher.h"
+
+using visualization_msgs::Marker;
+using visualization_msgs::MarkerArray;
+
+namespace or_rviz {
+namespace util {
+
+// Meshes can make these messages large, so don't let them pile up.
+static uint32_t const kQueueSize = 10;
+
+MarkerArrayPublisher::MarkerArrayPublisher(std::string const &topic_name)
+{
+    publisher_ = node_handle_.advertise<MarkerArray>(topic_name, kQueueSize,
+        boost::bind(&MarkerArrayPublisher::ConnectCallback, this, _1));
+}
+
+MarkerArrayPublisher::~MarkerArrayPublisher()
+{
+    // Clear RViz, like InteractiveMarkerServer does when it shuts down.
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        groups_.clear();
+        for (auto const &group : num_published_) {
+            dirty_names_.insert(group.first);
+        }
+    }
+    Flush();
+    publisher_.shutdown();
+}
+
+void MarkerArrayPublisher::Insert(std::string const &name,
+                                  std::vector<Marker> markers)
+{
+    for (size_t i = 0; i < markers.size(); ++i) {
+        markers[i].ns = name;
+        markers[i].id = i;
+        markers[i].action = Marker::ADD;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    groups_[name].swap(markers);
+    dirty_names_.insert(name);
+}
+
+void MarkerArrayPublisher::Erase(std::string const &name)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (groups_.erase(name)) {
+        dirty_names_.insert(name);
+    }
+}
+
+void MarkerArrayPublisher::Flush()
+{
+    MarkerArray message;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        for (std::string const &name : dirty_names_) {
+            size_t num_markers = 0;
+
+            auto const it = groups_.find(name);
+            if (it != groups_.end()) {
+                num_markers = it->second.size();
+                message.markers.insert(message.markers.end(),
+                                       it->second.begin(), it->second.end());
+            }
+
+            // Delete any markers left over from a larger version of the group.
+            size_t &num_published = num_published_[name];
+            for (size_t i = num_markers; i < num_published; ++i) {
+                Marker marker;
+                marker.ns = name;
+                marker.id = i;
+                marker.action = Marker::DELETE;
+                message.markers.push_back(marker);
+            }
+
+            if (num_markers > 0) {
+                num_published = num_markers;
+            } else {
+                num_published_.erase(name);
+            }
+        }
+        dirty_names_.clear();
+    }
+
+    if (!message.markers.empty()) {
+        publisher_.publish(message);
+    }
+}
+
+void MarkerArrayPublisher::ConnectCallback(
+        ros::SingleSubscriberPublisher const &publisher)
+{
+    MarkerArray message;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        for (std::vector<Marker> const &markers : groups_ | boost::adaptors::map_values) {
+            message.markers.insert(message.markers.end(),
+                                   markers.begin(), markers.end());
+        }
+    }
+
+    if (!message.markers.empty()) {
+        publisher.publish(message);
+    }
+}
+
+}
+}
@@ -0,0 +1,448 @@
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/make_shared.hpp>
+#include "util/MeshDiskCache.h"
+
+using boost::format;
+using boost::str;
+using geometry_msgs::Point;
+
+namespace bfs = boost::filesystem;
+namespace bip = boost::interprocess;
+
+typedef or_rviz::util::MeshDiskCache::PointList PointList;
+typedef or_rviz::util::MeshDiskCache::PointListConstPtr PointListConstPtr;
+
+namespace {
+
+char const kMagic[8] = { 'O', 'R', 'R', 'V', 'M', 'E', 'S', 'H' };
+char const kPointsMagic[8] = { 'O', 'R', 'R', 'V', 'P', 'N', 'T', 'S' };
+uint32_t const kVersion = 1;
+uint32_t const kPointsVersion = 1;
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_length;
+    uint64_t num_vertices;
+    uint64_t num_indices;
+};
+
+// Followed by the key, an array of num_lists point counts, and the points of
+// each list as XYZ doubles.
+struct PointsFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t key_length;
+    uint32_t has_lods;
+    uint32_t num_lists;
+};
+
+// Points are stored in the same layout as geometry_msgs::Point, so they can
+// be copied straight into a marker when the compiler doesn't pad it.
+bool const kIsPointPacked = sizeof(Point) == 3 * sizeof(double)
+    && offsetof(Point, y) == offsetof(Point, x) + sizeof(double)
+    && offsetof(Point, z) == offsetof(Point, x) + 2 * sizeof(double);
+
+struct Chunk {
+    Chunk(void const *data, size_t size) : data(data), size(size) { }
+
+    void const *data;
+    size_t size;
+};
+
+// The key is padded so the arrays after it are aligned when the file is
+// mapped.
+size_t GetDataOffset(size_t header_size, size_t key_length)
+{
+    size_t const unpadded = header_size + key_length;
+    return (unpadded + 7) & ~static_cast<size_t>(7);
+}
+
+// Guards against hash collisions between different keys.
+bool IsKeyEqual(char const *data, size_t size, size_t header_size,
+                size_t key_length, std::string const &key)
+{
+    return key_length == key.size()
+        && GetDataOffset(header_size, key_length) <= size
+        && key.compare(0, key.size(), data + header_size, key_length) == 0;
+}
+
+// Writes to a temporary file and renames it into place, so concurrent
+// readers (possibly in other processes) never see a partial entry.
+void WriteEntry(std::string const &path, std::string const &entry_path,
+                std::vector<Chunk> const &chunks)
+{
+    try {
+        bfs::path const entry(entry_path);
+        bfs::create_directories(entry.parent_path());
+
+        bfs::path const temp_path = entry.parent_path()
+            / bfs::unique_path("%%%%-%%%%-%%%%-%%%%.tmp");
+        {
+            std::ofstream stream(temp_path.string().c_str(), std::ios::binary);
+            for (Chunk const &chunk : chunks) {
+                stream.write(static_cast<char const *>(chunk.data), chunk.size);
+            }
+
+            if (!stream) {
+                RAVELOG_WARN("Failed writing mesh cache entry for '%s'.\n",
+                             path.c_str());
+                stream.close();
+                bfs::remove(temp_path);
+                return;
+            }
+        }
+        bfs::rename(temp_path, entry);
+    } catch (bfs::filesystem_error const &e) {
+        RAVELOG_WARN("Failed writing mesh cache entry for '%s': %s\n",
+                     path.c_str(), e.what());
+    }
+}
+
+}
+
+namespace or_rviz {
+namespace util {
+
+char const * const MeshDiskCache::kEnvironmentVariable = "OR_RVIZ_MESH_CACHE";
+
+MeshDiskCache::MeshDiskCache()
+{
+    char const *directory = std::getenv(kEnvironmentVariable);
+    if (directory) {
+        directory_ = directory;
+    }
+}
+
+MeshDiskCache &MeshDiskCache::instance()
+{
+    static MeshDiskCache cache;
+    return cache;
+}
+
+std::string MeshDiskCache::directory() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return directory_;
+}
+
+void MeshDiskCache::set_directory(std::string const &directory)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    directory_ = directory;
+}
+
+bool MeshDiskCache::is_enabled() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return !directory_.empty();
+}
+
+bool MeshDiskCache::Load(std::string const &path,
+                         OpenRAVE::Vector const &scale,
+                         OpenRAVE::TriMesh *trimesh) const
+{
+    BOOST_ASSERT(trimesh);
+
+    std::string key, entry_path;
+    if (!GetEntry(path, scale, ".mesh", &key, &entry_path)
+            || !bfs::exists(entry_path)) {
+        return false;
+    }
+
+    try {
+        bip::file_mapping const file(entry_path.c_str(), bip::read_only);
+        bip::mapped_region const region(file, bip::read_only);
+        char const *data = static_cast<char const *>(region.get_address());
+        size_t const size = region.get_size();
+
+        if (size < sizeof(FileHeader)) {
+            return false;
+        }
+
+        FileHeader header;
+        std::memcpy(&header, data, sizeof(header));
+
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0
+                || header.version != kVersion
+                || !IsKeyEqual(data, size, sizeof(header), header.key_length,
+                               key)) {
+            return false;
+        }
+
+        size_t const data_offset
+            = GetDataOffset(sizeof(header), header.key_length);
+        size_t const vertex_bytes = 3 * sizeof(float) * header.num_vertices;
+        size_t const index_bytes = sizeof(int32_t) * header.num_indices;
+        if (data_offset + vertex_bytes + index_bytes != size
+                || header.num_indices % 3 != 0) {
+            return false;
+        }
+
+        float const *vertices
+            = reinterpret_cast<float const *>(data + data_offset);
+        int32_t const *indices
+            = reinterpret_cast<int32_t const *>(data + data_offset + vertex_bytes);
+
+        trimesh->vertices.resize(header.num_vertices);
+        for (size_t i = 0; i < header.num_vertices; ++i) {
+            trimesh->vertices[i] = OpenRAVE::Vector(
+                vertices[3 * i + 0], vertices[3 * i + 1], vertices[3 * i + 2]);
+        }
+
+        trimesh->indices.assign(indices, indices + header.num_indices);
+        for (int const index : trimesh->indices) {
+            if (index < 0 || static_cast<uint64_t>(index) >= header.num_vertices) {
+                return false;
+            }
+        }
+        return true;
+    } catch (bip::interprocess_exception const &e) {
+        RAVELOG_DEBUG("Failed reading mesh cache entry '%s': %s\n",
+                      entry_path.c_str(), e.what());
+        return false;
+    }
+}
+
+void MeshDiskCache::Store(std::string const &path,
+                          OpenRAVE::Vector const &scale,
+                          OpenRAVE::TriMesh const &trimesh) const
+{
+    std::string key, entry_path;
+    if (!GetEntry(path, scale, ".mesh", &key, &entry_path)) {
+        return;
+    }
+
+    FileHeader header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.key_length = key.size();
+    header.num_vertices = trimesh.vertices.size();
+    header.num_indices = trimesh.indices.size();
+
+    size_t const padding = GetDataOffset(sizeof(header), key.size())
+        - sizeof(header) - key.size();
+
+    std::vector<float> vertices(3 * trimesh.vertices.size());
+    for (size_t i = 0; i < trimesh.vertices.size(); ++i) {
+        vertices[3 * i + 0] = trimesh.vertices[i].x;
+        vertices[3 * i + 1] = trimesh.vertices[i].y;
+        vertices[3 * i + 2] = trimesh.vertices[i].z;
+    }
+
+    std::vector<int32_t> const indices(trimesh.indices.begin(),
+                                       trimesh.indices.end());
+
+    std::vector<Chunk> chunks;
+    chunks.push_back(Chunk(&header, sizeof(header)));
+    chunks.push_back(Chunk(key.data(), key.size()));
+    chunks.push_back(Chunk("\0\0\0\0\0\0\0", padding));
+    chunks.push_back(Chunk(vertices.data(), vertices.size() * sizeof(float)));
+    chunks.push_back(Chunk(indices.data(), indices.size() * sizeof(int32_t)));
+    WriteEntry(path, entry_path, chunks);
+}
+
+bool MeshDiskCache::LoadPoints(std::string const &path,
+                               OpenRAVE::Vector const &scale,
+                               PointListConstPtr *points,
+                               std::vector<PointListConstPtr> *lods,
+                               bool *has_lods) const
+{
+    BOOST_ASSERT(points);
+    BOOST_ASSERT(lods);
+    BOOST_ASSERT(has_lods);
+
+    std::string key, entry_path;
+    if (!GetEntry(path, scale, ".points", &key, &entry_path)
+            || !bfs::exists(entry_path)) {
+        return false;
+    }
+
+    try {
+        bip::file_mapping const file(entry_path.c_str(), bip::read_only);
+        bip::mapped_region const region(file, bip::read_only);
+        char const *data = static_cast<char const *>(region.get_address());
+        size_t const size = region.get_size();
+
+        if (size < sizeof(PointsFileHeader)) {
+            return false;
+        }
+
+        PointsFileHeader header;
+        std::memcpy(&header, data, sizeof(header));
+
+        if (std::memcmp(header.magic, kPointsMagic, sizeof(kPointsMagic)) != 0
+                || header.version != kPointsVersion
+                || header.num_lists == 0
+                || !IsKeyEqual(data, size, sizeof(header), header.key_length,
+                               key)) {
+            return false;
+        }
+
+        size_t offset = GetDataOffset(sizeof(header), header.key_length);
+        size_t const counts_bytes = sizeof(uint64_t) * header.num_lists;
+        if (offset + counts_bytes > size) {
+            return false;
+        }
+
+        std::vector<uint64_t> counts(header.num_lists);
+        std::memcpy(counts.data(), data + offset, counts_bytes);
+        offset += counts_bytes;
+
+        // Check every count before allocating anything, so a corrupt entry
+        // can't ask for more memory than the file holds.
+        size_t expected_size = offset;
+        for (uint64_t const count : counts) {
+            if (count == 0 || count % 3 != 0
+                    || count > (size - offset) / (3 * sizeof(double))) {
+                return false;
+            }
+            expected_size += 3 * sizeof(double) * count;
+        }
+        if (expected_size != size) {
+            return false;
+        }
+
+        std::vector<PointListConstPtr> lists;
+        lists.reserve(counts.size());
+
+        for (uint64_t const count : counts) {
+            double const *values = reinterpret_cast<double const *>(data + offset);
+            auto const list = boost::make_shared<PointList>(count);
+
+            if (kIsPointPacked) {
+                std::memcpy(&list->front().x, values, 3 * sizeof(double) * count);
+            } else {
+                for (size_t i = 0; i < count; ++i) {
+                    Point &point = (*list)[i];
+                    point.x = values[3 * i + 0];
+                    point.y = values[3 * i + 1];
+                    point.z = values[3 * i + 2];
+                }
+            }
+
+            lists.push_back(list);
+            offset += 3 * sizeof(double) * count;
+        }
+
+        *points = lists.front();
+        lods->assign(lists.begin() + 1, lists.end());
+        *has_lods = header.has_lods != 0;
+        return true;
+    } catch (bip::interprocess_exception const &e) {
+        RAVELOG_DEBUG("Failed reading mesh cache entry '%s': %s\n",
+                      entry_path.c_str(), e.what());
+        return false;
+    }
+}
+
+void MeshDiskCache::StorePoints(std::string const &path,
+                                OpenRAVE::Vector const &scale,
+                                PointList const &points,
+                                std::vector<PointListConstPtr> const &lods,
+                                bool has_lods) const
+{
+    BOOST_ASSERT(!points.empty());
+
+    std::string key, entry_path;
+    if (!GetEntry(path, scale, ".points", &key, &entry_path)) {
+        return;
+    }
+
+    std::vector<PointList const *> lists;
+    lists.push_back(&points);
+    for (PointListConstPtr const &lod : lods) {
+        BOOST_ASSERT(lod && !lod->empty());
+        lists.push_back(lod.get());
+    }
+
+    PointsFileHeader header;
+    std::memcpy(header.magic, kPointsMagic, sizeof(kPointsMagic));
+    header.version = kPointsVersion;
+    header.key_length = key.size();
+    header.has_lods = has_lods;
+    header.num_lists = lists.size();
+
+    size_t const padding = GetDataOffset(sizeof(header), key.size())
+        - sizeof(header) - key.size();
+
+    std::vector<uint64_t> counts;
+    for (PointList const *list : lists) {
+        counts.push_back(list->size());
+    }
+
+    std::vector<Chunk> chunks;
+    chunks.push_back(Chunk(&header, sizeof(header)));
+    chunks.push_back(Chunk(key.data(), key.size()));
+    chunks.push_back(Chunk("\0\0\0\0\0\0\0", padding));
+    chunks.push_back(Chunk(counts.data(), counts.size() * sizeof(uint64_t)));
+
+    // Unpacked points are copied into a flat buffer first.
+    std::vector<std::vector<double> > unpacked;
+    for (PointList const *list : lists) {
+        if (kIsPointPacked) {
+            chunks.push_back(Chunk(&list->front().x,
+                                   3 * sizeof(double) * list->size()));
+            continue;
+        }
+
+        unpacked.push_back(std::vector<double>());
+        std::vector<double> &values = unpacked.back();
+        values.reserve(3 * list->size());
+        for (Point const &point : *list) {
+            values.push_back(point.x);
+            values.push_back(point.y);
+            values.push_back(point.z);
+        }
+    }
+    for (std::vector<double> const &values : unpacked) {
+        chunks.push_back(Chunk(values.data(), values.size() * sizeof(double)));
+    }
+
+    WriteEntry(path, entry_path, chunks);
+}
+
+bool MeshDiskCache::GetEntry(std::string const &path,
+                             OpenRAVE::Vector const &scale,
+                             char const *extension,
+                             std::string *key, std::string *entry_path) const
+{
+    std::string const directory = this->directory();
+    if (directory.empty()) {
+        return false;
+    }
+
+    // Only local files have a modification time. Anything else (e.g. a
+    // resource URI) is loaded normally.
+    try {
+        if (!bfs::is_regular_file(path)) {
+            return false;
+        }
+
+        bfs::path const canonical_path = bfs::canonical(path);
+        std::time_t const mtime = bfs::last_write_time(canonical_path);
+
+        *key = str(format("%s\n%d\n%.9g %.9g %.9g")
+            % canonical_path.string() % mtime % scale.x % scale.y % scale.z);
+    } catch (bfs::filesystem_error const &e) {
+        RAVELOG_DEBUG("Not caching mesh '%s': %s\n", path.c_str(), e.what());
+        return false;
+    }
+
+    size_t const hash = boost::hash<std::string>()(*key);
+    *entry_path = (bfs::path(directory)
+        / str(format("%016x%s") % hash % extension)).string();
+    return true;
+}
+
+}
+}
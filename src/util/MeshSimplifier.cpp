@@ -0,0 +1,536 @@
+#include <algorithm>
+#include <cmath>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include "util/MeshSimplifier.h"
+
+using geometry_msgs::Point;
+
+namespace {
+
+// Collapses are attempted in rounds with a growing error threshold,
+// threshold = kThresholdScale * (round + 3)^kAggressiveness, instead of
+// keeping a priority queue of edges. This is much faster on large meshes
+// and gives nearly the same result.
+double const kThresholdScale = 1e-9;
+double const kAggressiveness = 7.;
+int const kMaxRounds = 100;
+
+// Rebuilding the vertex-to-triangle references is linear in the mesh size,
+// so it is only done every few rounds.
+int const kRoundsPerUpdate = 5;
+
+// Collapses that bend a triangle further than this are treated as flips.
+double const kMinNormalDot = 0.2;
+
+// Largest RMS distance, as a fraction of the bounding box diagonal, that a
+// vertex may be moved from the planes of the triangles it replaces.
+double const kMaxRelativeDeviation = 0.01;
+
+struct PointKey {
+    double x, y, z;
+
+    bool operator==(PointKey const &other) const
+    {
+        return x == other.x && y == other.y && z == other.z;
+    }
+};
+
+struct PointKeyHash {
+    size_t operator()(PointKey const &key) const
+    {
+        size_t seed = 0;
+        boost::hash_combine(seed, key.x);
+        boost::hash_combine(seed, key.y);
+        boost::hash_combine(seed, key.z);
+        return seed;
+    }
+};
+
+inline void Subtract(double const a[3], double const b[3], double out[3])
+{
+    out[0] = a[0] - b[0];
+    out[1] = a[1] - b[1];
+    out[2] = a[2] - b[2];
+}
+
+inline double Dot(double const a[3], double const b[3])
+{
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+inline void Cross(double const a[3], double const b[3], double out[3])
+{
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+inline void Normalize(double v[3])
+{
+    double const norm = std::sqrt(Dot(v, v));
+    if (norm > 0.) {
+        v[0] /= norm;
+        v[1] /= norm;
+        v[2] /= norm;
+    }
+}
+
+}
+
+namespace or_rviz {
+namespace util {
+
+MeshSimplifier::Quadric::Quadric()
+    : num_planes(0.)
+{
+    std::fill(m, m + 10, 0.);
+}
+
+MeshSimplifier::Quadric::Quadric(double a, double b, double c, double d)
+    : num_planes(1.)
+{
+    m[0] = a * a; m[1] = a * b; m[2] = a * c; m[3] = a * d;
+                  m[4] = b * b; m[5] = b * c; m[6] = b * d;
+                                m[7] = c * c; m[8] = c * d;
+                                              m[9] = d * d;
+}
+
+MeshSimplifier::Quadric &MeshSimplifier::Quadric::operator+=(Quadric const &other)
+{
+    for (int i = 0; i < 10; ++i) {
+        m[i] += other.m[i];
+    }
+    num_planes += other.num_planes;
+    return *this;
+}
+
+double MeshSimplifier::Quadric::Error(double const p[3]) const
+{
+    double const x = p[0], y = p[1], z = p[2];
+    return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+         + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+         + m[7] * z * z + 2 * m[8] * z
+         + m[9];
+}
+
+double MeshSimplifier::Quadric::Det(int a11, int a12, int a13,
+                                    int a21, int a22, int a23,
+                                    int a31, int a32, int a33) const
+{
+    return m[a11] * m[a22] * m[a33] + m[a13] * m[a21] * m[a32]
+         + m[a12] * m[a23] * m[a31] - m[a13] * m[a22] * m[a31]
+         - m[a11] * m[a23] * m[a32] - m[a12] * m[a21] * m[a33];
+}
+
+MeshSimplifier::MeshSimplifier(PointList const &triangles)
+    : num_deleted_(0)
+    , max_error_(0.)
+{
+    BOOST_ASSERT(triangles.size() % 3 == 0);
+
+    boost::unordered_map<PointKey, size_t, PointKeyHash> indices;
+    std::vector<size_t> corners(triangles.size());
+
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        Point const &point = triangles[i];
+        PointKey const key = { point.x, point.y, point.z };
+
+        auto const result = indices.insert(std::make_pair(key, vertices_.size()));
+        if (result.second) {
+            Vertex vertex;
+            vertex.p[0] = point.x;
+            vertex.p[1] = point.y;
+            vertex.p[2] = point.z;
+            vertex.tstart = 0;
+            vertex.tcount = 0;
+            vertex.border = false;
+            vertices_.push_back(vertex);
+        }
+        corners[i] = result.first->second;
+    }
+
+    if (!vertices_.empty()) {
+        double lower[3], upper[3];
+        std::copy(vertices_.front().p, vertices_.front().p + 3, lower);
+        std::copy(vertices_.front().p, vertices_.front().p + 3, upper);
+        for (Vertex const &vertex : vertices_) {
+            for (int i = 0; i < 3; ++i) {
+                lower[i] = std::min(lower[i], vertex.p[i]);
+                upper[i] = std::max(upper[i], vertex.p[i]);
+            }
+        }
+
+        double diagonal[3];
+        Subtract(upper, lower, diagonal);
+        max_error_ = kMaxRelativeDeviation * kMaxRelativeDeviation
+                   * Dot(diagonal, diagonal);
+    }
+
+    triangles_.reserve(triangles.size() / 3);
+    for (size_t i = 0; i < corners.size(); i += 3) {
+        Triangle triangle;
+        triangle.v[0] = corners[i + 0];
+        triangle.v[1] = corners[i + 1];
+        triangle.v[2] = corners[i + 2];
+        triangle.deleted = false;
+        triangle.dirty = false;
+
+        // Drop triangles that were degenerate in the input.
+        if (triangle.v[0] != triangle.v[1] && triangle.v[1] != triangle.v[2]
+                && triangle.v[2] != triangle.v[0]) {
+            triangles_.push_back(triangle);
+        }
+    }
+
+    UpdateRefs();
+    InitializeQuadrics();
+}
+
+size_t MeshSimplifier::num_triangles() const
+{
+    return triangles_.size() - num_deleted_;
+}
+
+void MeshSimplifier::Simplify(size_t target_triangles)
+{
+    std::vector<bool> deleted0, deleted1;
+
+    for (int round = 0; round < kMaxRounds; ++round) {
+        if (num_triangles() <= target_triangles) {
+            break;
+        }
+
+        if (round % kRoundsPerUpdate == 0) {
+            Compact();
+            UpdateRefs();
+        }
+
+        for (Triangle &triangle : triangles_) {
+            triangle.dirty = false;
+        }
+
+        double const threshold
+            = kThresholdScale * std::pow(round + 3., kAggressiveness);
+
+        for (size_t itri = 0; itri < triangles_.size(); ++itri) {
+            // Triangles that changed this round have stale references, so
+            // they wait for the next round.
+            Triangle &triangle = triangles_[itri];
+            if (triangle.error[3] > threshold || triangle.deleted
+                    || triangle.dirty) {
+                continue;
+            }
+
+            for (int j = 0; j < 3; ++j) {
+                if (triangle.error[j] > threshold) {
+                    continue;
+                }
+
+                size_t const iv0 = triangle.v[j];
+                size_t const iv1 = triangle.v[(j + 1) % 3];
+                Vertex &v0 = vertices_[iv0];
+                Vertex const &v1 = vertices_[iv1];
+
+                if (v0.border != v1.border) {
+                    continue;
+                }
+
+                // The quadric error is a sum over planes, so the mean is
+                // compared against the limit.
+                double p[3];
+                double const error = EdgeError(iv0, iv1, p);
+                if (error > max_error_ * (v0.q.num_planes + v1.q.num_planes)) {
+                    continue;
+                }
+
+                deleted0.assign(v0.tcount, false);
+                deleted1.assign(v1.tcount, false);
+                if (IsFlipped(p, iv1, v0, &deleted0)
+                        || IsFlipped(p, iv0, v1, &deleted1)) {
+                    continue;
+                }
+
+                // Move v0 to the optimal position and point every triangle
+                // of v1 at it. Triangles that used the edge are deleted.
+                std::copy(p, p + 3, v0.p);
+                v0.q += v1.q;
+
+                size_t const tstart = refs_.size();
+                UpdateTriangles(iv0, v0, deleted0);
+                UpdateTriangles(iv0, v1, deleted1);
+                size_t const tcount = refs_.size() - tstart;
+
+                // Re-use v0's slot in refs_ if the new references fit.
+                if (tcount <= v0.tcount) {
+                    std::copy(refs_.begin() + tstart, refs_.end(),
+                              refs_.begin() + v0.tstart);
+                    refs_.resize(tstart);
+                } else {
+                    v0.tstart = tstart;
+                }
+                v0.tcount = tcount;
+                break;
+            }
+
+            if (num_triangles() <= target_triangles) {
+                break;
+            }
+        }
+    }
+
+    Compact();
+    UpdateRefs();
+}
+
+void MeshSimplifier::GetTriangles(PointList *points) const
+{
+    BOOST_ASSERT(points);
+
+    points->clear();
+    points->reserve(3 * num_triangles());
+
+    for (Triangle const &triangle : triangles_) {
+        if (triangle.deleted) {
+            continue;
+        }
+
+        for (int j = 0; j < 3; ++j) {
+            Vertex const &vertex = vertices_[triangle.v[j]];
+            Point point;
+            point.x = vertex.p[0];
+            point.y = vertex.p[1];
+            point.z = vertex.p[2];
+            points->push_back(point);
+        }
+    }
+}
+
+void MeshSimplifier::Compact()
+{
+    triangles_.erase(
+        std::remove_if(triangles_.begin(), triangles_.end(),
+            [](Triangle const &triangle) { return triangle.deleted; }),
+        triangles_.end());
+    num_deleted_ = 0;
+}
+
+void MeshSimplifier::UpdateRefs()
+{
+    for (Vertex &vertex : vertices_) {
+        vertex.tstart = 0;
+        vertex.tcount = 0;
+    }
+
+    for (Triangle const &triangle : triangles_) {
+        for (int j = 0; j < 3; ++j) {
+            ++vertices_[triangle.v[j]].tcount;
+        }
+    }
+
+    size_t tstart = 0;
+    for (Vertex &vertex : vertices_) {
+        vertex.tstart = tstart;
+        tstart += vertex.tcount;
+        vertex.tcount = 0;
+    }
+
+    refs_.resize(3 * triangles_.size());
+    for (size_t itri = 0; itri < triangles_.size(); ++itri) {
+        Triangle const &triangle = triangles_[itri];
+        for (int j = 0; j < 3; ++j) {
+            Vertex &vertex = vertices_[triangle.v[j]];
+            Ref &ref = refs_[vertex.tstart + vertex.tcount];
+            ref.tid = itri;
+            ref.tvertex = j;
+            ++vertex.tcount;
+        }
+    }
+}
+
+void MeshSimplifier::InitializeQuadrics()
+{
+    // An edge is on the boundary if only one triangle uses it. Both of its
+    // vertices are then boundary vertices.
+    std::vector<size_t> neighbors, counts;
+
+    for (Vertex const &vertex : vertices_) {
+        neighbors.clear();
+        counts.clear();
+
+        for (size_t k = 0; k < vertex.tcount; ++k) {
+            Triangle const &triangle = triangles_[refs_[vertex.tstart + k].tid];
+            for (int j = 0; j < 3; ++j) {
+                size_t const neighbor = triangle.v[j];
+                auto const it = std::find(neighbors.begin(), neighbors.end(),
+                                          neighbor);
+                if (it == neighbors.end()) {
+                    neighbors.push_back(neighbor);
+                    counts.push_back(1);
+                } else {
+                    ++counts[it - neighbors.begin()];
+                }
+            }
+        }
+
+        for (size_t k = 0; k < neighbors.size(); ++k) {
+            if (counts[k] == 1) {
+                vertices_[neighbors[k]].border = true;
+            }
+        }
+    }
+
+    // Each vertex starts with the sum of the planes of its triangles.
+    for (Triangle &triangle : triangles_) {
+        UpdateNormal(&triangle);
+
+        double const *n = triangle.normal;
+        double const *p0 = vertices_[triangle.v[0]].p;
+        Quadric const plane(n[0], n[1], n[2], -Dot(n, p0));
+        for (int j = 0; j < 3; ++j) {
+            vertices_[triangle.v[j]].q += plane;
+        }
+    }
+
+    for (Triangle &triangle : triangles_) {
+        double p[3];
+        for (int j = 0; j < 3; ++j) {
+            triangle.error[j] = EdgeError(triangle.v[j], triangle.v[(j + 1) % 3], p);
+        }
+        triangle.error[3] = std::min(triangle.error[0],
+                                     std::min(triangle.error[1], triangle.error[2]));
+    }
+}
+
+void MeshSimplifier::UpdateNormal(Triangle *triangle) const
+{
+    double const *p0 = vertices_[triangle->v[0]].p;
+    double e1[3], e2[3];
+    Subtract(vertices_[triangle->v[1]].p, p0, e1);
+    Subtract(vertices_[triangle->v[2]].p, p0, e2);
+    Cross(e1, e2, triangle->normal);
+    Normalize(triangle->normal);
+}
+
+double MeshSimplifier::EdgeError(size_t iv0, size_t iv1, double p[3]) const
+{
+    Vertex const &v0 = vertices_[iv0];
+    Vertex const &v1 = vertices_[iv1];
+
+    Quadric q = v0.q;
+    q += v1.q;
+
+    double midpoint[3], edge[3];
+    for (int i = 0; i < 3; ++i) {
+        midpoint[i] = (v0.p[i] + v1.p[i]) / 2.;
+    }
+    Subtract(v1.p, v0.p, edge);
+
+    // Solve for the point that minimizes the error, unless the quadric is
+    // singular or the edge is on the boundary. On nearly flat patches the
+    // quadric is close to singular and the solution can land far from the
+    // edge, so it is only used if it stays near the edge.
+    double const det = q.Det(0, 1, 2, 1, 4, 5, 2, 5, 7);
+    if (det != 0. && !(v0.border && v1.border)) {
+        p[0] = -1. / det * q.Det(1, 2, 3, 4, 5, 6, 5, 7, 8);
+        p[1] =  1. / det * q.Det(0, 2, 3, 1, 5, 6, 2, 7, 8);
+        p[2] = -1. / det * q.Det(0, 1, 3, 1, 4, 6, 2, 5, 8);
+
+        double offset[3];
+        Subtract(p, midpoint, offset);
+        if (Dot(offset, offset) <= Dot(edge, edge)) {
+            return q.Error(p);
+        }
+    }
+
+    // Otherwise, pick the best of the endpoints and the midpoint.
+
+    double const error0 = q.Error(v0.p);
+    double const error1 = q.Error(v1.p);
+    double const error_mid = q.Error(midpoint);
+    double const error = std::min(error0, std::min(error1, error_mid));
+
+    if (error == error0) {
+        std::copy(v0.p, v0.p + 3, p);
+    } else if (error == error1) {
+        std::copy(v1.p, v1.p + 3, p);
+    } else {
+        std::copy(midpoint, midpoint + 3, p);
+    }
+    return error;
+}
+
+bool MeshSimplifier::IsFlipped(double const p[3], size_t iv1, Vertex const &v0,
+                               std::vector<bool> *deleted) const
+{
+    for (size_t k = 0; k < v0.tcount; ++k) {
+        Ref const &ref = refs_[v0.tstart + k];
+        Triangle const &triangle = triangles_[ref.tid];
+        if (triangle.deleted) {
+            continue;
+        }
+
+        size_t const id1 = triangle.v[(ref.tvertex + 1) % 3];
+        size_t const id2 = triangle.v[(ref.tvertex + 2) % 3];
+
+        // This triangle contains the edge, so it disappears.
+        if (id1 == iv1 || id2 == iv1) {
+            (*deleted)[k] = true;
+            continue;
+        }
+
+        double d1[3], d2[3];
+        Subtract(vertices_[id1].p, p, d1);
+        Subtract(vertices_[id2].p, p, d2);
+        Normalize(d1);
+        Normalize(d2);
+
+        if (std::fabs(Dot(d1, d2)) > 0.999) {
+            return true;
+        }
+
+        double normal[3];
+        Cross(d1, d2, normal);
+        Normalize(normal);
+
+        if (Dot(normal, triangle.normal) < kMinNormalDot) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void MeshSimplifier::UpdateTriangles(size_t iv0, Vertex const &v,
+                                     std::vector<bool> const &deleted)
+{
+    for (size_t k = 0; k < v.tcount; ++k) {
+        // Copy the reference; pushing onto refs_ may reallocate it.
+        Ref const ref = refs_[v.tstart + k];
+        Triangle &triangle = triangles_[ref.tid];
+        if (triangle.deleted) {
+            continue;
+        }
+
+        if (deleted[k]) {
+            triangle.deleted = true;
+            ++num_deleted_;
+            continue;
+        }
+
+        triangle.v[ref.tvertex] = iv0;
+        triangle.dirty = true;
+        UpdateNormal(&triangle);
+
+        double p[3];
+        for (int j = 0; j < 3; ++j) {
+            triangle.error[j] = EdgeError(triangle.v[j], triangle.v[(j + 1) % 3], p);
+        }
+        triangle.error[3] = std::min(triangle.error[0],
+                                     std::min(triangle.error[1], triangle.error[2]));
+
+        refs_.push_back(ref);
+    }
+}
+
+}
+}
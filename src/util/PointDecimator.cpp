@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cmath>
+#include <stdint.h>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_set.hpp>
+#include "util/PointDecimator.h"
+
+using geometry_msgs::Point;
+using std_msgs::ColorRGBA;
+
+namespace {
+
+struct VoxelKey {
+    int64_t x, y, z;
+
+    bool operator==(VoxelKey const &other) const
+    {
+        return x == other.x && y == other.y && z == other.z;
+    }
+};
+
+struct VoxelKeyHash {
+    size_t operator()(VoxelKey const &key) const
+    {
+        size_t seed = 0;
+        boost::hash_combine(seed, key.x);
+        boost::hash_combine(seed, key.y);
+        boost::hash_combine(seed, key.z);
+        return seed;
+    }
+};
+
+typedef boost::unordered_set<VoxelKey, VoxelKeyHash> VoxelSet;
+
+// Calls fn(ichunk, begin, end) on num_chunks consecutive chunks of [0, n).
+// The first chunk runs on the calling thread and the rest on new threads.
+void ForEachChunk(size_t n, size_t num_chunks,
+                  boost::function<void (size_t, size_t, size_t)> const &fn)
+{
+    if (num_chunks <= 1) {
+        fn(0, 0, n);
+        return;
+    }
+
+    size_t const chunk_size = (n + num_chunks - 1) / num_chunks;
+
+    boost::thread_group threads;
+    for (size_t ichunk = 1; ichunk < num_chunks; ++ichunk) {
+        size_t const begin = std::min(n, ichunk * chunk_size);
+        size_t const end = std::min(n, begin + chunk_size);
+        threads.create_thread(boost::bind(fn, ichunk, begin, end));
+    }
+    fn(0, 0, std::min(n, chunk_size));
+    threads.join_all();
+}
+
+}
+
+namespace or_rviz {
+namespace util {
+
+// Below this size a chunk is cheaper to process than to hand to a thread.
+size_t const PointDecimator::kMinChunkPoints = 65536;
+
+PointDecimator::PointDecimator()
+    : voxel_size_(0.)
+    , point_budget_(0)
+    , num_input_points_(0)
+    , num_dropped_points_(0)
+{
+}
+
+double PointDecimator::voxel_size() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return voxel_size_;
+}
+
+void PointDecimator::set_voxel_size(double voxel_size)
+{
+    BOOST_ASSERT(voxel_size >= 0.);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    voxel_size_ = voxel_size;
+}
+
+size_t PointDecimator::point_budget() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return point_budget_;
+}
+
+void PointDecimator::set_point_budget(size_t point_budget)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    point_budget_ = point_budget;
+}
+
+size_t PointDecimator::num_input_points() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return num_input_points_;
+}
+
+size_t PointDecimator::num_dropped_points() const
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    return num_dropped_points_;
+}
+
+size_t PointDecimator::Decimate(std::vector<Point> *points,
+                                std::vector<ColorRGBA> *colors)
+{
+    BOOST_ASSERT(points);
+    BOOST_ASSERT(colors);
+    BOOST_ASSERT(colors->empty() || colors->size() == points->size());
+
+    double voxel_size;
+    size_t point_budget;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        voxel_size = voxel_size_;
+        point_budget = point_budget_;
+        num_input_points_ += points->size();
+    }
+
+    size_t const num_points = points->size();
+    bool const is_over_budget = point_budget > 0 && num_points > point_budget;
+    if (voxel_size <= 0. && !is_over_budget) {
+        return 0;
+    }
+
+    // Indices of the points to keep, in increasing order.
+    std::vector<size_t> indices;
+    if (voxel_size > 0.) {
+        VoxelGridFilter(*points, voxel_size, &indices);
+    }
+
+    if (voxel_size <= 0.) {
+        indices.resize(point_budget);
+        for (size_t i = 0; i < point_budget; ++i) {
+            indices[i] = i * num_points / point_budget;
+        }
+    } else if (point_budget > 0 && indices.size() > point_budget) {
+        size_t const num_voxels = indices.size();
+        for (size_t i = 0; i < point_budget; ++i) {
+            indices[i] = indices[i * num_voxels / point_budget];
+        }
+        indices.resize(point_budget);
+    }
+
+    // Gather the kept points into new buffers, one chunk per thread.
+    size_t const num_kept = indices.size();
+    std::vector<Point> kept_points(num_kept);
+    std::vector<ColorRGBA> kept_colors(colors->empty() ? 0 : num_kept);
+
+    size_t const num_chunks = std::max<size_t>(1, std::min<size_t>(
+        boost::thread::hardware_concurrency(), num_kept / kMinChunkPoints));
+
+    ForEachChunk(num_kept, num_chunks,
+        [&](size_t ichunk, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                kept_points[i] = (*points)[indices[i]];
+            }
+            if (!kept_colors.empty()) {
+                for (size_t i = begin; i < end; ++i) {
+                    kept_colors[i] = (*colors)[indices[i]];
+                }
+            }
+        });
+
+    points->swap(kept_points);
+    colors->swap(kept_colors);
+
+    size_t const num_dropped = num_points - num_kept;
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        num_dropped_points_ += num_dropped;
+    }
+    return num_dropped;
+}
+
+void PointDecimator::VoxelGridFilter(std::vector<Point> const &points,
+                                     double voxel_size,
+                                     std::vector<size_t> *indices)
+{
+    BOOST_ASSERT(voxel_size > 0.);
+    BOOST_ASSERT(indices);
+
+    size_t const num_points = points.size();
+    size_t const num_chunks = std::max<size_t>(1, std::min<size_t>(
+        boost::thread::hardware_concurrency(), num_points / kMinChunkPoints));
+
+    // Each chunk keeps the first point in each voxel it touches. The chunks
+    // are then merged in order, so the result matches a serial pass.
+    std::vector<std::vector<size_t> > chunk_indices(num_chunks);
+    std::vector<std::vector<VoxelKey> > chunk_keys(num_chunks);
+
+    ForEachChunk(num_points, num_chunks,
+        [&](size_t ichunk, size_t begin, size_t end) {
+            std::vector<size_t> &kept_indices = chunk_indices[ichunk];
+            std::vector<VoxelKey> &kept_keys = chunk_keys[ichunk];
+            VoxelSet voxels;
+
+            for (size_t i = begin; i < end; ++i) {
+                Point const &point = points[i];
+                if (!std::isfinite(point.x) || !std::isfinite(point.y)
+                        || !std::isfinite(point.z)) {
+                    continue;
+                }
+
+                VoxelKey key;
+                key.x = static_cast<int64_t>(std::floor(point.x / voxel_size));
+                key.y = static_cast<int64_t>(std::floor(point.y / voxel_size));
+                key.z = static_cast<int64_t>(std::floor(point.z / voxel_size));
+
+                if (voxels.insert(key).second) {
+                    kept_indices.push_back(i);
+                    kept_keys.push_back(key);
+                }
+            }
+        });
+
+    if (num_chunks == 1) {
+        indices->swap(chunk_indices.front());
+        return;
+    }
+
+    VoxelSet voxels;
+    indices->clear();
+
+    for (size_t ichunk = 0; ichunk < num_chunks; ++ichunk) {
+        std::vector<size_t> const &kept_indices = chunk_indices[ichunk];
+        std::vector<VoxelKey> const &kept_keys = chunk_keys[ichunk];
+
+        for (size_t i = 0; i < kept_indices.size(); ++i) {
+            if (voxels.insert(kept_keys[i]).second) {
+                indices->push_back(kept_indices[i]);
+            }
+        }
+    }
+}
+
+}
+}
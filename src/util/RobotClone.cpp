@@ -0,0 +1,75 @@
+#include "util/RobotClone.h"
+
+namespace or_rviz {
+namespace util {
+
+RobotClone::RobotClone(OpenRAVE::RobotBasePtr const &robot)
+{
+    BOOST_ASSERT(robot);
+
+    env_ = OpenRAVE::RaveCreateEnvironment();
+    env_->StopSimulation();
+
+    OpenRAVE::EnvironmentMutex::scoped_lock lock(env_->GetMutex());
+    robot_ = OpenRAVE::RaveCreateRobot(env_, robot->GetXMLId());
+    robot_->Clone(robot, OpenRAVE::Clone_Bodies);
+    env_->Add(robot_, true);
+
+    // IK solvers are bound to one robot, so they may not survive cloning.
+    std::vector<OpenRAVE::RobotBase::ManipulatorPtr> const &manipulators
+        = robot->GetManipulators();
+
+    for (OpenRAVE::RobotBase::ManipulatorPtr const &manipulator : manipulators) {
+        OpenRAVE::IkSolverBasePtr const ik_solver = manipulator->GetIkSolver();
+        OpenRAVE::RobotBase::ManipulatorPtr const clone_manipulator
+            = robot_->GetManipulator(manipulator->GetName());
+        if (!ik_solver || !clone_manipulator || clone_manipulator->GetIkSolver()) {
+            continue;
+        }
+
+        OpenRAVE::IkSolverBasePtr const clone_ik_solver
+            = OpenRAVE::RaveCreateIkSolver(env_, ik_solver->GetXMLId());
+        if (!clone_ik_solver || !clone_manipulator->SetIkSolver(clone_ik_solver)) {
+            RAVELOG_WARN("Failed cloning IK solver '%s' for manipulator '%s'.\n",
+                ik_solver->GetXMLId().c_str(), manipulator->GetName().c_str());
+        }
+    }
+}
+
+RobotClone::~RobotClone()
+{
+    // Environments are registered globally, so they aren't destroyed when
+    // the last reference goes away.
+    robot_.reset();
+    env_->Destroy();
+}
+
+OpenRAVE::EnvironmentBasePtr RobotClone::env() const
+{
+    return env_;
+}
+
+OpenRAVE::RobotBasePtr RobotClone::robot() const
+{
+    return robot_;
+}
+
+void RobotClone::GetState(OpenRAVE::RobotBasePtr const &robot,
+                          std::vector<OpenRAVE::dReal> *dof_values,
+                          OpenRAVE::Transform *transform)
+{
+    BOOST_ASSERT(dof_values && transform);
+
+    robot->GetDOFValues(*dof_values);
+    *transform = robot->GetTransform();
+}
+
+void RobotClone::SetState(std::vector<OpenRAVE::dReal> const &dof_values,
+                          OpenRAVE::Transform const &transform)
+{
+    robot_->SetTransform(transform);
+    robot_->SetDOFValues(dof_values, OpenRAVE::KinBody::CLA_Nothing);
+}
+
+}
+}
@@ -0,0 +1,484 @@
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/unordered_set.hpp>
+#include "util/MeshDiskCache.h"
+#include "util/MeshSimplifier.h"
+#include "util/TriMeshCache.h"
+
+using geometry_msgs::Point;
+
+typedef OpenRAVE::KinBody::Link::GeometryPtr GeometryPtr;
+typedef boost::shared_ptr<OpenRAVE::TriMesh> TriMeshPtr;
+
+namespace or_rviz {
+namespace util {
+
+size_t const TriMeshCache::kMaxWorkers = 4;
+size_t const TriMeshCache::kMinPruneInterval = 64;
+size_t const TriMeshCache::kLodReduction = 4;
+size_t const TriMeshCache::kMinLodTriangles = 1000;
+double const TriMeshCache::kFailureLifetime = 10.;
+
+TriMeshCache::Key::Key()
+    : mesh(NULL)
+{
+    scale[0] = scale[1] = scale[2] = 0;
+}
+
+TriMeshCache::Key::Key(void const *mesh, std::string const &uri,
+                       OpenRAVE::Vector const &scale)
+    : mesh(mesh)
+    , uri(uri)
+{
+    this->scale[0] = scale.x;
+    this->scale[1] = scale.y;
+    this->scale[2] = scale.z;
+}
+
+bool TriMeshCache::Key::operator==(Key const &other) const
+{
+    return mesh == other.mesh
+        && uri == other.uri
+        && scale[0] == other.scale[0]
+        && scale[1] == other.scale[1]
+        && scale[2] == other.scale[2];
+}
+
+size_t TriMeshCache::KeyHash::operator()(Key const &key) const
+{
+    size_t seed = 0;
+    boost::hash_combine(seed, key.mesh);
+    boost::hash_combine(seed, key.uri);
+    boost::hash_combine(seed, key.scale[0]);
+    boost::hash_combine(seed, key.scale[1]);
+    boost::hash_combine(seed, key.scale[2]);
+    return seed;
+}
+
+TriMeshCache::TriMeshCache()
+    : num_inserts_(0)
+    , prune_interval_(kMinPruneInterval)
+    , next_load_id_(0)
+    , stopping_(false)
+{
+}
+
+TriMeshCache::~TriMeshCache()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+        stopping_ = true;
+        requests_.clear();
+    }
+    requests_condition_.notify_all();
+    workers_.join_all();
+}
+
+TriMeshCache &TriMeshCache::instance()
+{
+    static TriMeshCache cache;
+    return cache;
+}
+
+TriMeshCache::PointListConstPtr TriMeshCache::GetCollisionMeshAsync(
+        GeometryPtr const &geometry, size_t max_triangles, bool *is_pending)
+{
+    BOOST_ASSERT(geometry);
+    BOOST_ASSERT(is_pending);
+
+    OpenRAVE::TriMesh const &trimesh = geometry->GetCollisionMesh();
+    Key const key(&trimesh, "", geometry->GetInfo()._vCollisionScale);
+
+    Entry entry;
+    if (Find(key, &entry)) {
+        if (entry.is_pending || !NeedsLods(entry, max_triangles)) {
+            *is_pending = entry.is_pending;
+            return entry.is_pending ? PointListConstPtr()
+                                    : SelectLod(entry, max_triangles);
+        }
+    } else {
+        auto const new_points = boost::make_shared<PointList>();
+        ConvertTriMesh(trimesh, new_points.get());
+
+        entry.has_owner = true;
+        entry.owner = geometry;
+        entry.points = new_points;
+
+        if (!NeedsLods(entry, max_triangles)) {
+            Insert(key, entry);
+            *is_pending = false;
+            return entry.points;
+        }
+    }
+
+    // The worker only simplifies the points we just converted, so it doesn't
+    // need the environment.
+    Queue(key, entry, boost::weak_ptr<OpenRAVE::EnvironmentBase>(),
+          max_triangles);
+
+    *is_pending = true;
+    return PointListConstPtr();
+}
+
+bool TriMeshCache::IsCollisionMeshPending(GeometryPtr const &geometry)
+{
+    BOOST_ASSERT(geometry);
+
+    Key const key(&geometry->GetCollisionMesh(), "",
+                  geometry->GetInfo()._vCollisionScale);
+
+    Entry cached;
+    return Find(key, &cached) && cached.is_pending;
+}
+
+void TriMeshCache::EvictCollisionMeshes(OpenRAVE::KinBody const &body)
+{
+    boost::unordered_set<void const *> meshes;
+    for (OpenRAVE::KinBody::LinkPtr const &link : body.GetLinks()) {
+        for (GeometryPtr const &geometry : link->GetGeometries()) {
+            meshes.insert(&geometry->GetCollisionMesh());
+        }
+    }
+
+    // Meshes are keyed by address and scale, so look at every entry in case
+    // the scale changed too.
+    boost::mutex::scoped_lock lock(mutex_);
+
+    EntryMap::iterator it = entries_.begin();
+    while (it != entries_.end()) {
+        if (it->first.mesh && meshes.count(it->first.mesh)) {
+            it = entries_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+TriMeshCache::PointListConstPtr TriMeshCache::GetRenderMeshAsync(
+        OpenRAVE::EnvironmentBasePtr const &env, std::string const &uri,
+        OpenRAVE::Vector const &scale, size_t max_triangles, bool *is_pending)
+{
+    BOOST_ASSERT(env);
+    BOOST_ASSERT(is_pending);
+
+    Key const key(NULL, uri, scale);
+
+    // Meshes that were loaded without a budget are simplified on a worker,
+    // just like they were loaded.
+    Entry entry;
+    if (Find(key, &entry)) {
+        if (entry.is_pending || !NeedsLods(entry, max_triangles)) {
+            *is_pending = entry.is_pending;
+            return SelectLod(entry, max_triangles);
+        }
+    }
+
+    Queue(key, entry, env, max_triangles);
+
+    *is_pending = true;
+    return PointListConstPtr();
+}
+
+bool TriMeshCache::IsRenderMeshPending(std::string const &uri,
+                                       OpenRAVE::Vector const &scale)
+{
+    Entry cached;
+    return Find(Key(NULL, uri, scale), &cached) && cached.is_pending;
+}
+
+void TriMeshCache::Queue(Key const &key, Entry entry,
+                         boost::weak_ptr<OpenRAVE::EnvironmentBase> const &env,
+                         size_t max_triangles)
+{
+    {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        // Tag the entry so the worker can tell if it was evicted or replaced
+        // while the request was queued.
+        entry.is_pending = true;
+        entry.load_id = ++next_load_id_;
+        InsertLocked(key, entry);
+
+        LoadRequest request;
+        request.key = key;
+        request.env = env;
+        request.max_triangles = max_triangles;
+        request.load_id = entry.load_id;
+        requests_.push_back(request);
+
+        // Start the workers on first use. Loading is mostly parsing, so a
+        // few threads are enough to keep up with a large robot.
+        if (workers_.size() == 0) {
+            size_t const num_workers = std::max<size_t>(1,
+                std::min<size_t>(kMaxWorkers,
+                                 boost::thread::hardware_concurrency()));
+            for (size_t i = 0; i < num_workers; ++i) {
+                workers_.create_thread(
+                    boost::bind(&TriMeshCache::WorkerThread, this));
+            }
+        }
+    }
+    requests_condition_.notify_one();
+}
+
+void TriMeshCache::Clear()
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    entries_.clear();
+}
+
+void TriMeshCache::ConvertTriMesh(OpenRAVE::TriMesh const &trimesh,
+                                  PointList *points)
+{
+    BOOST_ASSERT(points);
+    BOOST_ASSERT(trimesh.indices.size() % 3 == 0);
+
+    // RViz doesn't render empty TRIANGLE_LISTs, so we insert a degenerate
+    // triangle as a placeholder.
+    if (trimesh.indices.empty()) {
+        points->assign(3, Point());
+        return;
+    }
+
+    size_t const num_vertices = trimesh.vertices.size();
+    size_t const num_indices = trimesh.indices.size();
+    points->resize(num_indices);
+
+    for (size_t i = 0; i < num_indices; ++i) {
+        int const index = trimesh.indices[i];
+        BOOST_ASSERT(index >= 0 && static_cast<size_t>(index) < num_vertices);
+
+        OpenRAVE::Vector const &vertex = trimesh.vertices[index];
+        Point &point = (*points)[i];
+        point.x = vertex.x;
+        point.y = vertex.y;
+        point.z = vertex.z;
+    }
+}
+
+void TriMeshCache::BuildLods(PointList const &points,
+                             std::vector<PointListConstPtr> *lods)
+{
+    BOOST_ASSERT(lods);
+
+    lods->clear();
+
+    // Each tier continues simplifying the previous one.
+    MeshSimplifier simplifier(points);
+    size_t num_triangles = points.size() / 3;
+
+    while (num_triangles / kLodReduction >= kMinLodTriangles) {
+        simplifier.Simplify(num_triangles / kLodReduction);
+
+        // Stop if the simplifier gets stuck, e.g. on a mesh of slivers. The
+        // last tier is then the coarsest available.
+        if (2 * simplifier.num_triangles() > num_triangles) {
+            break;
+        }
+
+        auto const lod = boost::make_shared<PointList>();
+        simplifier.GetTriangles(lod.get());
+        lods->push_back(lod);
+        num_triangles = simplifier.num_triangles();
+    }
+
+    RAVELOG_DEBUG("Built %d LOD tiers for a mesh with %d triangles.\n",
+                  static_cast<int>(lods->size()),
+                  static_cast<int>(points.size() / 3));
+}
+
+bool TriMeshCache::NeedsLods(Entry const &entry, size_t max_triangles)
+{
+    return max_triangles > 0
+        && entry.points
+        && !entry.has_lods
+        && entry.points->size() / 3 > max_triangles;
+}
+
+TriMeshCache::PointListConstPtr TriMeshCache::SelectLod(
+        Entry const &entry, size_t max_triangles)
+{
+    if (max_triangles == 0 || !entry.points
+            || entry.points->size() / 3 <= max_triangles) {
+        return entry.points;
+    }
+
+    for (PointListConstPtr const &lod : entry.lods) {
+        if (lod->size() / 3 <= max_triangles) {
+            return lod;
+        }
+    }
+
+    // Nothing fits, so use the coarsest tier.
+    if (!entry.lods.empty()) {
+        return entry.lods.back();
+    }
+    return entry.points;
+}
+
+bool TriMeshCache::IsExpired(Entry const &entry)
+{
+    // The mesh's address may have been re-used by a different geometry.
+    if (entry.has_owner && entry.owner.expired()) {
+        return true;
+    }
+    return entry.has_expiry && boost::get_system_time() > entry.expiry;
+}
+
+bool TriMeshCache::Find(Key const &key, Entry *entry)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+
+    EntryMap::iterator const it = entries_.find(key);
+    if (it == entries_.end()) {
+        return false;
+    }
+
+    if (IsExpired(it->second)) {
+        entries_.erase(it);
+        return false;
+    }
+
+    *entry = it->second;
+    return true;
+}
+
+void TriMeshCache::Insert(Key const &key, Entry const &entry)
+{
+    boost::mutex::scoped_lock lock(mutex_);
+    InsertLocked(key, entry);
+}
+
+void TriMeshCache::InsertLocked(Key const &key, Entry const &entry)
+{
+    // Drop entries for geometry that no longer exists and failures that are
+    // due to be retried. This is linear in the
+    // size of the cache, so it only runs once the number of inserts catches
+    // up with the number of entries. That keeps inserts O(1) amortized.
+    if (++num_inserts_ >= prune_interval_) {
+        EntryMap::iterator it = entries_.begin();
+        while (it != entries_.end()) {
+            if (IsExpired(it->second)) {
+                it = entries_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        num_inserts_ = 0;
+        prune_interval_ = std::max(kMinPruneInterval, entries_.size());
+    }
+
+    entries_[key] = entry;
+}
+
+void TriMeshCache::WorkerThread()
+{
+    for (;;) {
+        LoadRequest request;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            while (!stopping_ && requests_.empty()) {
+                requests_condition_.wait(lock);
+            }
+            if (stopping_) {
+                return;
+            }
+
+            request = requests_.front();
+            requests_.pop_front();
+        }
+
+        // Re-use the mesh if it is only being simplified. Skip the request if
+        // the entry was evicted, e.g. because its geometry changed.
+        Entry entry;
+        {
+            boost::mutex::scoped_lock lock(mutex_);
+            EntryMap::const_iterator const it = entries_.find(request.key);
+            if (it == entries_.end() || it->second.load_id != request.load_id
+                    || IsExpired(it->second)) {
+                continue;
+            }
+            entry = it->second;
+        }
+
+        OpenRAVE::Vector const scale(request.key.scale[0], request.key.scale[1],
+                                     request.key.scale[2]);
+
+        // The environment may have been destroyed while the request was
+        // queued. That says nothing about the file, so drop the entry instead
+        // of caching the failure.
+        bool is_failure_cached = false;
+        bool is_modified = false;
+        if (!entry.points) {
+            if (OpenRAVE::EnvironmentBasePtr const env = request.env.lock()) {
+                is_modified = LoadRenderMesh(env, request.key.uri, scale, &entry);
+                is_failure_cached = !entry.points;
+            }
+        }
+
+        if (NeedsLods(entry, request.max_triangles)) {
+            BuildLods(*entry.points, &entry.lods);
+            entry.has_lods = true;
+            is_modified = true;
+        }
+
+        // Write render meshes back to disk once, after any LOD tiers they
+        // need, so the next run skips both converting and simplifying them.
+        if (is_modified && !request.key.mesh && entry.points) {
+            MeshDiskCache::instance().StorePoints(request.key.uri, scale,
+                *entry.points, entry.lods, entry.has_lods);
+        }
+
+        boost::mutex::scoped_lock lock(mutex_);
+        EntryMap::iterator const it = entries_.find(request.key);
+        if (it == entries_.end() || it->second.load_id != request.load_id) {
+            continue;
+        } else if (!entry.points && !is_failure_cached) {
+            entries_.erase(it);
+            continue;
+        }
+
+        // Retry failed loads after a while, e.g. in case the file was fixed
+        // or a new environment can load it.
+        Entry &cached = it->second;
+        if (is_failure_cached) {
+            cached.has_expiry = true;
+            cached.expiry = boost::get_system_time()
+                + boost::posix_time::milliseconds(
+                    static_cast<int64_t>(kFailureLifetime * 1000.));
+        }
+        cached.is_pending = false;
+        cached.points = entry.points;
+        cached.has_lods = entry.has_lods;
+        cached.lods.swap(entry.lods);
+    }
+}
+
+bool TriMeshCache::LoadRenderMesh(
+        OpenRAVE::EnvironmentBasePtr const &env, std::string const &uri,
+        OpenRAVE::Vector const &scale, Entry *entry)
+{
+    BOOST_ASSERT(entry);
+
+    if (MeshDiskCache::instance().LoadPoints(uri, scale, &entry->points,
+                                             &entry->lods, &entry->has_lods)) {
+        return false;
+    }
+
+    TriMeshPtr trimesh = boost::make_shared<OpenRAVE::TriMesh>();
+    trimesh = env->ReadTrimeshURI(trimesh, uri);
+    if (!trimesh) {
+        return false;
+    }
+
+    auto const points = boost::make_shared<PointList>();
+    ConvertTriMesh(*trimesh, points.get());
+    entry->points = points;
+    return true;
+}
+
+}
+}
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include <boost/assert.hpp>
+#include <boost/bind.hpp>
+#include <boost/ref.hpp>
+#include <boost/thread/thread.hpp>
+#include "util/VertexNormals.h"
+
+namespace or_rviz {
+namespace util {
+
+size_t const kParallelNormalThreshold = 1 << 16;
+
+namespace {
+
+// Triangles are processed as structure-of-arrays so the per-triangle math can
+// run four triangles at a time in SSE registers.
+struct TriangleSoA {
+    std::vector<float> x[3], y[3], z[3];
+};
+
+struct CornerWeightsSoA {
+    std::vector<float> nx, ny, nz;
+    std::vector<float> w[3];
+};
+
+// Approximation of acos from Abramowitz and Stegun 4.4.45. Unlike std::acos,
+// it is easy to evaluate in SIMD registers.
+inline float ApproximateAcos(float x)
+{
+    float const ax = std::min(std::fabs(x), 1.0f);
+    float const r = std::sqrt(1.0f - ax)
+        * (1.5707288f + ax * (-0.2121144f + ax * (0.0742610f - 0.0187293f * ax)));
+    return (x < 0.0f) ? static_cast<float>(M_PI) - r : r;
+}
+
+inline float CornerAngle(float dot, float length_a, float length_b)
+{
+    float const denominator = length_a * length_b;
+    if (denominator <= std::numeric_limits<float>::min()) {
+        return 0.0f;
+    }
+    return ApproximateAcos(std::max(-1.0f, std::min(1.0f, dot / denominator)));
+}
+
+void ComputeCornerWeightsScalar(TriangleSoA const &tris, CornerWeightsSoA &out,
+                                size_t begin, size_t end)
+{
+    for (size_t t = begin; t < end; ++t) {
+        float const e01x = tris.x[1][t] - tris.x[0][t];
+        float const e01y = tris.y[1][t] - tris.y[0][t];
+        float const e01z = tris.z[1][t] - tris.z[0][t];
+        float const e02x = tris.x[2][t] - tris.x[0][t];
+        float const e02y = tris.y[2][t] - tris.y[0][t];
+        float const e02z = tris.z[2][t] - tris.z[0][t];
+        float const e12x = tris.x[2][t] - tris.x[1][t];
+        float const e12y = tris.y[2][t] - tris.y[1][t];
+        float const e12z = tris.z[2][t] - tris.z[1][t];
+
+        out.nx[t] = e01y * e02z - e01z * e02y;
+        out.ny[t] = e01z * e02x - e01x * e02z;
+        out.nz[t] = e01x * e02y - e01y * e02x;
+
+        float const l01 = std::sqrt(e01x * e01x + e01y * e01y + e01z * e01z);
+        float const l02 = std::sqrt(e02x * e02x + e02y * e02y + e02z * e02z);
+        float const l12 = std::sqrt(e12x * e12x + e12y * e12y + e12z * e12z);
+
+        out.w[0][t] = CornerAngle(e01x * e02x + e01y * e02y + e01z * e02z, l01, l02);
+        out.w[1][t] = CornerAngle(-(e01x * e12x + e01y * e12y + e01z * e12z), l01, l12);
+        out.w[2][t] = CornerAngle(e02x * e12x + e02y * e12y + e02z * e12z, l02, l12);
+    }
+}
+
+#ifdef __SSE2__
+inline __m128 ApproximateAcos4(__m128 x)
+{
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const one = _mm_set1_ps(1.0f);
+    __m128 const sign_mask = _mm_set1_ps(-0.0f);
+
+    __m128 const ax = _mm_min_ps(_mm_andnot_ps(sign_mask, x), one);
+    __m128 poly = _mm_add_ps(_mm_set1_ps(0.0742610f), _mm_mul_ps(_mm_set1_ps(-0.0187293f), ax));
+    poly = _mm_add_ps(_mm_set1_ps(-0.2121144f), _mm_mul_ps(ax, poly));
+    poly = _mm_add_ps(_mm_set1_ps(1.5707288f), _mm_mul_ps(ax, poly));
+    __m128 const r = _mm_mul_ps(_mm_sqrt_ps(_mm_sub_ps(one, ax)), poly);
+
+    __m128 const negative = _mm_cmplt_ps(x, zero);
+    __m128 const reflected = _mm_sub_ps(_mm_set1_ps(static_cast<float>(M_PI)), r);
+    return _mm_or_ps(_mm_and_ps(negative, reflected), _mm_andnot_ps(negative, r));
+}
+
+inline __m128 CornerAngle4(__m128 dot, __m128 length_a, __m128 length_b)
+{
+    __m128 const min_denominator = _mm_set1_ps(std::numeric_limits<float>::min());
+    __m128 const denominator = _mm_mul_ps(length_a, length_b);
+    __m128 const valid = _mm_cmpgt_ps(denominator, min_denominator);
+    __m128 cosine = _mm_div_ps(dot, _mm_max_ps(denominator, min_denominator));
+    cosine = _mm_max_ps(_mm_set1_ps(-1.0f), _mm_min_ps(_mm_set1_ps(1.0f), cosine));
+    return _mm_and_ps(valid, ApproximateAcos4(cosine));
+}
+
+inline __m128 Length4(__m128 x, __m128 y, __m128 z)
+{
+    return _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)),
+                                  _mm_mul_ps(z, z)));
+}
+
+inline __m128 Dot4(__m128 ax, __m128 ay, __m128 az,
+                   __m128 bx, __m128 by, __m128 bz)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                      _mm_mul_ps(az, bz));
+}
+#endif
+
+void ComputeCornerWeights(TriangleSoA const &tris, CornerWeightsSoA &out,
+                          size_t begin, size_t end)
+{
+    size_t t = begin;
+
+#ifdef __SSE2__
+    for (; t + 4 <= end; t += 4) {
+        __m128 const x0 = _mm_loadu_ps(&tris.x[0][t]);
+        __m128 const y0 = _mm_loadu_ps(&tris.y[0][t]);
+        __m128 const z0 = _mm_loadu_ps(&tris.z[0][t]);
+        __m128 const x1 = _mm_loadu_ps(&tris.x[1][t]);
+        __m128 const y1 = _mm_loadu_ps(&tris.y[1][t]);
+        __m128 const z1 = _mm_loadu_ps(&tris.z[1][t]);
+        __m128 const x2 = _mm_loadu_ps(&tris.x[2][t]);
+        __m128 const y2 = _mm_loadu_ps(&tris.y[2][t]);
+        __m128 const z2 = _mm_loadu_ps(&tris.z[2][t]);
+
+        __m128 const e01x = _mm_sub_ps(x1, x0);
+        __m128 const e01y = _mm_sub_ps(y1, y0);
+        __m128 const e01z = _mm_sub_ps(z1, z0);
+        __m128 const e02x = _mm_sub_ps(x2, x0);
+        __m128 const e02y = _mm_sub_ps(y2, y0);
+        __m128 const e02z = _mm_sub_ps(z2, z0);
+        __m128 const e12x = _mm_sub_ps(x2, x1);
+        __m128 const e12y = _mm_sub_ps(y2, y1);
+        __m128 const e12z = _mm_sub_ps(z2, z1);
+
+        _mm_storeu_ps(&out.nx[t], _mm_sub_ps(_mm_mul_ps(e01y, e02z), _mm_mul_ps(e01z, e02y)));
+        _mm_storeu_ps(&out.ny[t], _mm_sub_ps(_mm_mul_ps(e01z, e02x), _mm_mul_ps(e01x, e02z)));
+        _mm_storeu_ps(&out.nz[t], _mm_sub_ps(_mm_mul_ps(e01x, e02y), _mm_mul_ps(e01y, e02x)));
+
+        __m128 const l01 = Length4(e01x, e01y, e01z);
+        __m128 const l02 = Length4(e02x, e02y, e02z);
+        __m128 const l12 = Length4(e12x, e12y, e12z);
+
+        __m128 const d0 = Dot4(e01x, e01y, e01z, e02x, e02y, e02z);
+        __m128 const d1 = _mm_sub_ps(_mm_setzero_ps(), Dot4(e01x, e01y, e01z, e12x, e12y, e12z));
+        __m128 const d2 = Dot4(e02x, e02y, e02z, e12x, e12y, e12z);
+
+        _mm_storeu_ps(&out.w[0][t], CornerAngle4(d0, l01, l02));
+        _mm_storeu_ps(&out.w[1][t], CornerAngle4(d1, l01, l12));
+        _mm_storeu_ps(&out.w[2][t], CornerAngle4(d2, l02, l12));
+    }
+#endif
+
+    ComputeCornerWeightsScalar(tris, out, t, end);
+}
+
+}
+
+void ComputeVertexNormals(float const *vertices, size_t num_vertices,
+                          int const *indices, size_t num_triangles,
+                          float *normals)
+{
+    BOOST_ASSERT(vertices || num_vertices == 0);
+    BOOST_ASSERT(indices || num_triangles == 0);
+    BOOST_ASSERT(normals || num_vertices == 0);
+
+    TriangleSoA tris;
+    CornerWeightsSoA weights;
+    for (int j = 0; j < 3; ++j) {
+        tris.x[j].resize(num_triangles);
+        tris.y[j].resize(num_triangles);
+        tris.z[j].resize(num_triangles);
+        weights.w[j].resize(num_triangles);
+    }
+    weights.nx.resize(num_triangles);
+    weights.ny.resize(num_triangles);
+    weights.nz.resize(num_triangles);
+
+    for (size_t t = 0; t < num_triangles; ++t) {
+        for (int j = 0; j < 3; ++j) {
+            float const *vertex = vertices + 3 * indices[3 * t + j];
+            tris.x[j][t] = vertex[0];
+            tris.y[j][t] = vertex[1];
+            tris.z[j][t] = vertex[2];
+        }
+    }
+
+    // The per-triangle work is independent, so large meshes split it across
+    // threads. Accumulating into the vertices is cheap and stays serial.
+    size_t const num_threads = std::max(1u, boost::thread::hardware_concurrency());
+    if (num_triangles < kParallelNormalThreshold || num_threads == 1) {
+        ComputeCornerWeights(tris, weights, 0, num_triangles);
+    } else {
+        size_t const chunk_size = (num_triangles + num_threads - 1) / num_threads;
+        boost::thread_group threads;
+        for (size_t begin = 0; begin < num_triangles; begin += chunk_size) {
+            size_t const end = std::min(begin + chunk_size, num_triangles);
+            threads.create_thread(boost::bind(&ComputeCornerWeights,
+                boost::cref(tris), boost::ref(weights), begin, end));
+        }
+        threads.join_all();
+    }
+
+    std::fill(normals, normals + 3 * num_vertices, 0.0f);
+    for (size_t t = 0; t < num_triangles; ++t) {
+        for (int j = 0; j < 3; ++j) {
+            float *normal = normals + 3 * indices[3 * t + j];
+            float const w = weights.w[j][t];
+            normal[0] += w * weights.nx[t];
+            normal[1] += w * weights.ny[t];
+            normal[2] += w * weights.nz[t];
+        }
+    }
+
+    // Same as Ogre::Vector3::normalise, which leaves tiny vectors alone.
+    for (size_t i = 0; i < num_vertices; ++i) {
+        float *normal = normals + 3 * i;
+        float const length = std::sqrt(normal[0] * normal[0]
+            + normal[1] * normal[1] + normal[2] * normal[2]);
+        if (length > 1e-08f) {
+            normal[0] /= length;
+            normal[1] /= length;
+            normal[2] /= length;
+        }
+    }
+}
+
+}
+}
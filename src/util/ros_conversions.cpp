@@ -29,6 +29,12 @@ THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 *************************************************************************/
+#include <cstddef>
+#include <cstring>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "util/ros_conversions.h"
 
 using OpenRAVE::dReal;
@@ -45,6 +51,18 @@ namespace util {
 
 std::string const kDefaultWorldFrameId = "map";
 
+namespace {
+
+// The bulk color conversions write through the members of ColorRGBA as if it
+// were a plain array. This holds for every ROS message generator we know of,
+// but the scalar path is kept in case it does not.
+bool const kIsColorPacked = sizeof(ColorRGBA) == 4 * sizeof(float)
+    && offsetof(ColorRGBA, g) == offsetof(ColorRGBA, r) + sizeof(float)
+    && offsetof(ColorRGBA, b) == offsetof(ColorRGBA, r) + 2 * sizeof(float)
+    && offsetof(ColorRGBA, a) == offsetof(ColorRGBA, r) + 3 * sizeof(float);
+
+}
+
 /*
  * OpenRAVE to ROS
  */
@@ -99,6 +117,112 @@ Quaternion toROSQuaternion(RaveVector<Scalar> const &or_quat)
     return quaternion;
 }
 
+void toROSPoints(float const *points, int num_points, int stride,
+                 std::vector<Point> *out_points)
+{
+    BOOST_ASSERT(points);
+    BOOST_ASSERT(num_points >= 0);
+    BOOST_ASSERT(stride >= 0 && stride % sizeof(float) == 0);
+    BOOST_ASSERT(out_points);
+
+    out_points->resize(num_points);
+    if (num_points == 0) {
+        return;
+    }
+
+    auto const points_raw = reinterpret_cast<uint8_t const *>(points);
+    for (int ipoint = 0; ipoint < num_points; ++ipoint) {
+        float const *point = reinterpret_cast<float const *>(
+            points_raw + stride * ipoint);
+        Point &out_point = (*out_points)[ipoint];
+        out_point.x = point[0];
+        out_point.y = point[1];
+        out_point.z = point[2];
+    }
+}
+
+void toROSColors(float const *colors, int num_colors, bool has_alpha,
+                 std::vector<ColorRGBA> *out_colors)
+{
+    BOOST_ASSERT(colors);
+    BOOST_ASSERT(num_colors >= 0);
+    BOOST_ASSERT(out_colors);
+
+    out_colors->resize(num_colors);
+    if (num_colors == 0) {
+        return;
+    }
+
+    ColorRGBA *out = &out_colors->front();
+
+    if (has_alpha && kIsColorPacked) {
+        std::memcpy(&out->r, colors, 4 * sizeof(float) * num_colors);
+        return;
+    }
+
+    int const stride = has_alpha ? 4 : 3;
+    int icolor = 0;
+
+#ifdef __SSE2__
+    // Each load reads one float past an RGB triple, so the last color is
+    // left to the scalar loop.
+    if (!has_alpha && kIsColorPacked) {
+        __m128 const rgb_mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+        __m128 const alpha = _mm_set_ps(1.f, 0.f, 0.f, 0.f);
+
+        for (; icolor + 1 < num_colors; ++icolor) {
+            __m128 const rgb = _mm_loadu_ps(colors + 3 * icolor);
+            _mm_storeu_ps(&out[icolor].r,
+                          _mm_or_ps(_mm_and_ps(rgb, rgb_mask), alpha));
+        }
+    }
+#endif
+
+    for (; icolor < num_colors; ++icolor) {
+        ColorRGBA &out_color = out[icolor];
+        out_color.r = colors[icolor * stride + 0];
+        out_color.g = colors[icolor * stride + 1];
+        out_color.b = colors[icolor * stride + 2];
+
+        if (has_alpha) {
+            out_color.a = colors[icolor * stride + 3];
+        } else {
+            out_color.a = 1.0;
+        }
+    }
+}
+
+void toROSMeshPoints(float const *points, int stride,
+                     int const *indices, int num_triangles,
+                     std::vector<Point> *out_points)
+{
+    BOOST_ASSERT(points);
+    BOOST_ASSERT(stride > 0);
+    BOOST_ASSERT(indices);
+    BOOST_ASSERT(num_triangles >= 0);
+    BOOST_ASSERT(out_points);
+
+    // RViz doesn't render empty TRIANGLE_LISTs, so we insert a degenerate
+    // triangle as a placeholder.
+    if (num_triangles == 0) {
+        out_points->assign(3, Point());
+        return;
+    }
+
+    auto const points_raw = reinterpret_cast<uint8_t const *>(points);
+    int const num_indices = 3 * num_triangles;
+
+    out_points->resize(num_indices);
+    for (int iindex = 0; iindex < num_indices; ++iindex) {
+        float const *point = reinterpret_cast<float const *>(
+            points_raw + stride * indices[iindex]);
+        Point &out_point = (*out_points)[iindex];
+        out_point.x = point[0];
+        out_point.y = point[1];
+        out_point.z = point[2];
+    }
+}
+
 /*
  * ROS to OpenRAVE
  */